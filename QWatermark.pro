@@ -1,24 +1,17 @@
-TEMPLATE = app
-TARGET = QWatermark 
+TEMPLATE = subdirs
 
-QT        += core gui 
+SUBDIRS = engine gui cli bench tests
 
-HEADERS   += src/qwatermark.h \
-    src/profiledialog.h \
-    src/profile.h
-SOURCES   += src/main.cpp \
-    src/qwatermark.cpp \
-    src/profiledialog.cpp \
-    src/profile.cpp
-FORMS     += src/qwatermark.ui \     
-    src/profiledialog.ui
-RESOURCES += \
-    src/resources.qrc
+engine.subdir = src/engine
 
-mac {
-    # Copy the custom Info.plist to the app bundle
-    QMAKE_INFO_PLIST = src/Info.plist
+gui.file = src/gui.pro
+gui.depends = engine
 
-    # Icon is mandatory for submission
-    ICON = src/qwatermark.icns
-}
+cli.subdir = src/cli
+cli.depends = engine
+
+bench.subdir = bench
+bench.depends = engine
+
+tests.subdir = tests
+tests.depends = engine
@@ -0,0 +1,16 @@
+TEMPLATE = app
+TARGET = qwatermark-bench
+
+# not installed, run from the build directory:
+#   ./qwatermark-bench
+# writes bench-results.tsv there (QWATERMARK_BENCH_RESULTS to change it)
+QT        += core gui testlib
+CONFIG    += console
+CONFIG    -= app_bundle
+
+ENGINE_BUILD_DIR = $$OUT_PWD/../src/engine
+include(../src/engine/engine.pri)
+
+HEADERS   += corpus.h
+SOURCES   += corpus.cpp \
+    enginebench.cpp
@@ -0,0 +1,113 @@
+#include <QtDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QImageWriter>
+#include <QPainter>
+#include <QStringList>
+
+#include <math.h>
+
+#include "corpus.h"
+
+
+QList<Corpus::Entry> Corpus::entries(int maxMegapixels)
+{
+    static const Entry all[] = {
+        { "01mp-4x3", 1, 4, 3, "jpg" },
+        { "01mp-3x4", 1, 3, 4, "png" },
+        { "02mp-16x9", 2, 16, 9, "tif" },
+        { "04mp-3x2", 4, 3, 2, "jpg" },
+        { "06mp-1x1", 6, 1, 1, "png" },
+        { "12mp-4x3", 12, 4, 3, "jpg" },
+        { "12mp-2x3", 12, 2, 3, "tif" },
+        { "24mp-3x2", 24, 3, 2, "jpg" },
+        { "24mp-16x9", 24, 16, 9, "png" },
+        { "50mp-4x3", 50, 4, 3, "jpg" }
+    };
+
+    QList<Entry> ret;
+    for (unsigned i = 0; i < sizeof(all) / sizeof(all[0]); ++i)
+    {
+        if (all[i].megapixels <= maxMegapixels)
+            ret << all[i];
+    }
+    return ret;
+}
+
+QSize Corpus::size(const Entry &entry)
+{
+    double pixels = entry.megapixels * 1000000.0;
+    int w = int(sqrt(pixels * entry.aspectW / entry.aspectH));
+    return QSize(w, w * entry.aspectH / entry.aspectW);
+}
+
+QImage Corpus::image(const QSize &size, quint32 seed)
+{
+    QImage img(size, QImage::Format_RGB32);
+    quint32 state = seed * 2654435761u + 1;
+
+    for (int y = 0; y < img.height(); ++y)
+    {
+        QRgb *line = reinterpret_cast<QRgb *>(img.scanLine(y));
+        const int g = y * 255 / img.height();
+        for (int x = 0; x < img.width(); ++x)
+        {
+            // cheap LCG, a few levels of noise over smooth gradients
+            state = state * 1664525u + 1013904223u;
+            const int n = int(state >> 28) - 8;
+            const int r = x * 255 / img.width();
+            line[x] = qRgb(qBound(0, r + n, 255), qBound(0, g + n, 255), qBound(0, (r + g) / 2 - n, 255));
+        }
+    }
+
+    return img;
+}
+
+QImage Corpus::logo()
+{
+    QImage img(400, 160, QImage::Format_ARGB32_Premultiplied);
+    img.fill(0);
+
+    QPainter p(&img);
+    p.setRenderHint(QPainter::Antialiasing);
+    p.setPen(QPen(QColor(255, 255, 255, 220), 6));
+    p.setBrush(QColor(20, 60, 160, 140));
+    p.drawRoundedRect(img.rect().adjusted(4, 4, -4, -4), 24, 24);
+    p.end();
+
+    return img.convertToFormat(QImage::Format_ARGB32);
+}
+
+QStringList Corpus::generate(const QString &dir, const QList<Entry> &entries)
+{
+    QDir().mkpath(dir);
+    const QList<QByteArray> formats = QImageWriter::supportedImageFormats();
+
+    QStringList ret;
+    quint32 seed = 1;
+    foreach (const Entry &e, entries)
+    {
+        ++seed;
+        if (!formats.contains(e.suffix.toLatin1()))
+        {
+            qDebug() << "No writer for" << e.suffix << "skipping" << e.name;
+            continue;
+        }
+
+        QString fname = dir + '/' + e.name + '.' + e.suffix;
+        if (!QFileInfo(fname).exists())
+        {
+            QImageWriter writer(fname);
+            // fixed quality, the files must not follow the writer's default
+            writer.setQuality(90);
+            if (!writer.write(image(size(e), seed)))
+            {
+                qDebug() << "Cannot write" << fname << writer.errorString();
+                continue;
+            }
+        }
+        ret << fname;
+    }
+
+    return ret;
+}
@@ -0,0 +1,44 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <QImage>
+#include <QList>
+#include <QString>
+
+
+/*! Synthetic images for the benchmarks.
+ *
+ * The corpus is deterministic: the same entry always produces the same
+ * pixels, so results of different commits are comparable. Files are
+ * generated once into a directory and reused by later runs.
+ */
+class Corpus
+{
+public:
+
+    struct Entry {
+        QString name;
+        // megapixels and aspect ratio w:h
+        int megapixels;
+        int aspectW;
+        int aspectH;
+        QString suffix;
+    };
+
+    // mixed JPEG, PNG and TIFF from 1 to 50 MP, capped at maxMegapixels
+    static QList<Entry> entries(int maxMegapixels = 50);
+
+    static QSize size(const Entry &entry);
+    // gradient with noise, roughly as compressible as a photo
+    static QImage image(const QSize &size, quint32 seed);
+    // half transparent logo for image profiles
+    static QImage logo();
+
+    /* Writes the missing entries into dir (created if needed), returns
+     * the written or already present file names. Formats Qt cannot
+     * write in this build are left out.
+     */
+    static QStringList generate(const QString &dir, const QList<Entry> &entries);
+};
+
+#endif // CORPUS_H
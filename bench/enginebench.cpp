@@ -0,0 +1,306 @@
+#include <QtTest>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QProcess>
+#include <QTemporaryFile>
+#include <QTextStream>
+
+#include "headless.h"
+#include "watermarkengine.h"
+#include "renderplan.h"
+#include "profile.h"
+#include "corpus.h"
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+
+/*! Benchmarks of the watermark engine.
+ *
+ * Every measurement is written to a tab separated file, one
+ * "test <tab> case <tab> metric <tab> value" line each, in a fixed
+ * order so two runs can simply be diffed; the file is rewritten on each
+ * run. The QTest output on stdout is only for reading along. The
+ * environment tunes it:
+ *
+ *   QWATERMARK_BENCH_DIR      corpus directory, generated once
+ *   QWATERMARK_BENCH_MAX_MP   largest corpus image in megapixels (50)
+ *   QWATERMARK_BENCH_RESULTS  result file (bench-results.tsv)
+ *
+ * Each throughput row runs in a child process of the bench, the peak
+ * RSS of a process only ever grows and would not tell the rows apart.
+ */
+class EngineBench : public QObject
+{
+    Q_OBJECT
+
+public:
+    EngineBench();
+
+private:
+    QString m_dir;
+    QStringList m_files;
+    qint64 m_corpusBytes;
+    Profile m_textProfile;
+    Profile m_imageProfile;
+    QFile m_results;
+    // running a single throughput row for its parent
+    bool m_child;
+
+    void result(const QString &test, const QString &dataTag, const QString &metric, double value);
+    static qint64 peakRss();
+    void throughputInChild();
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void paintOne_data();
+    void paintOne();
+
+    void throughput_data();
+    void throughput();
+};
+
+EngineBench::EngineBench()
+    : m_corpusBytes(0),
+      m_textProfile("bench-text"),
+      m_imageProfile("bench-image"),
+      m_child(!qgetenv("QWATERMARK_BENCH_CHILD").isEmpty())
+{
+}
+
+void EngineBench::result(const QString &test, const QString &dataTag, const QString &metric, double value)
+{
+    QTextStream s(&m_results);
+    s << test << '\t' << dataTag << '\t' << metric << '\t' << QString::number(value, 'f', 3) << '\n';
+}
+
+// bytes, 0 where the system does not tell
+qint64 EngineBench::peakRss()
+{
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+#ifdef Q_OS_MAC
+        return usage.ru_maxrss;
+#else
+        return qint64(usage.ru_maxrss) * 1024;
+#endif
+#endif
+    return 0;
+}
+
+void EngineBench::initTestCase()
+{
+    m_dir = qgetenv("QWATERMARK_BENCH_DIR");
+    if (m_dir.isEmpty())
+        m_dir = QDir::tempPath() + "/qwatermark-bench";
+
+    int maxMp = qgetenv("QWATERMARK_BENCH_MAX_MP").toInt();
+    if (maxMp <= 0)
+        maxMp = 50;
+
+    m_files = Corpus::generate(m_dir + "/corpus", Corpus::entries(maxMp));
+    QVERIFY(!m_files.isEmpty());
+    foreach (const QString &f, m_files)
+        m_corpusBytes += QFileInfo(f).size();
+
+    QString logoPath = m_dir + "/logo.png";
+    if (!QFileInfo(logoPath).exists())
+        QVERIFY(Corpus::logo().save(logoPath));
+
+    m_textProfile.setType(Profile::Text);
+    m_textProfile.setText("QWatermark benchmark");
+    m_textProfile.setFont(QFont("Sans", 48));
+    m_textProfile.setMainColor(Qt::white);
+    m_textProfile.setOutlineColor(Qt::black);
+    m_textProfile.setOutlineSize(2);
+    m_textProfile.setTransparency(0.5);
+    m_textProfile.setMarginHorizontal(20);
+    m_textProfile.setMarginVertical(20);
+
+    m_imageProfile.setType(Profile::Image);
+    m_imageProfile.setLogoPath(logoPath);
+    m_imageProfile.setTransparency(0.5);
+    m_imageProfile.setMarginHorizontal(20);
+    m_imageProfile.setMarginVertical(20);
+    QVERIFY(m_imageProfile.isValid());
+
+    QString resultsPath = qgetenv("QWATERMARK_BENCH_RESULTS");
+    if (resultsPath.isEmpty())
+        resultsPath = "bench-results.tsv";
+    m_results.setFileName(resultsPath);
+    QVERIFY(m_results.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text));
+    QTextStream(&m_results) << "# qwatermark-bench 1\n";
+
+    result("corpus", "all", "files", m_files.size());
+    result("corpus", "all", "MB", m_corpusBytes / (1024.0 * 1024.0));
+}
+
+void EngineBench::cleanupTestCase()
+{
+    result("process", "all", "peakRssMB", peakRss() / (1024.0 * 1024.0));
+    m_results.close();
+}
+
+void EngineBench::paintOne_data()
+{
+    QTest::addColumn<bool>("text");
+    QTest::addColumn<int>("position");
+    QTest::addColumn<int>("megapixels");
+
+    const int sizes[] = { 1, 12 };
+    for (int t = 0; t < 2; ++t)
+    {
+        for (int p = WatermarkEngine::UpperLeft; p <= WatermarkEngine::LowerRight; ++p)
+        {
+            for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+            {
+                QString tag = QString("%1-%2-%3mp").arg(t ? "text" : "image")
+                              .arg(WatermarkEngine::positionName(WatermarkEngine::Position(p)))
+                              .arg(sizes[s]);
+                QTest::newRow(tag.toLatin1().constData()) << bool(t) << p << sizes[s];
+            }
+        }
+    }
+}
+
+void EngineBench::paintOne()
+{
+    QFETCH(bool, text);
+    QFETCH(int, position);
+    QFETCH(int, megapixels);
+
+    Corpus::Entry e = { QString(), megapixels, 3, 2, QString() };
+    QImage image = Corpus::image(Corpus::size(e), 1);
+    Profile profile = text ? m_textProfile : m_imageProfile;
+
+    // made once per batch by the engine, time the per-image work only
+    RenderPlan plan(profile, WatermarkEngine::Position(position));
+    QVERIFY(plan.paint(&image));
+
+    int iterations = 0;
+    QElapsedTimer timer;
+    timer.start();
+    do
+    {
+        plan.paint(&image);
+        ++iterations;
+    } while (timer.elapsed() < 200);
+
+    const double ms = timer.nsecsElapsed() / 1e6 / iterations;
+    QTest::setBenchmarkResult(ms, QTest::WalltimeMilliseconds);
+    result("paintOne", QTest::currentDataTag(), "ms", ms);
+}
+
+void EngineBench::throughput_data()
+{
+    QTest::addColumn<int>("threads");
+
+    const int max = WatermarkEngine::defaultThreadCount();
+    for (int t = 1; t < max; t *= 2)
+        QTest::newRow(QString("%1-threads").arg(t).toLatin1().constData()) << t;
+    QTest::newRow(QString("%1-threads").arg(max).toLatin1().constData()) << max;
+}
+
+void EngineBench::throughput()
+{
+    QFETCH(int, threads);
+
+    if (!m_child)
+    {
+        throughputInChild();
+        return;
+    }
+
+    QString out = m_dir + "/out";
+    QDir().mkpath(out);
+
+    WatermarkEngine engine;
+    engine.setProfile(m_imageProfile);
+    engine.setPosition(WatermarkEngine::LowerRight);
+    engine.setSourcePath(m_dir + "/corpus");
+    engine.setDestinationPath(out);
+    engine.setThreadCount(threads);
+
+    QEventLoop loop;
+    connect(&engine, SIGNAL(finished()), &loop, SLOT(quit()));
+
+    QElapsedTimer timer;
+    timer.start();
+    engine.start();
+    if (engine.isRunning())
+        loop.exec();
+    const double seconds = timer.nsecsElapsed() / 1e9;
+
+    const BatchStats &stats = engine.stats();
+    QCOMPARE(stats.count(BatchStats::Written), m_files.size());
+
+    QTest::setBenchmarkResult(seconds * 1000, QTest::WalltimeMilliseconds);
+    result("throughput", QTest::currentDataTag(), "images/s", m_files.size() / seconds);
+    result("throughput", QTest::currentDataTag(), "MB/s", m_corpusBytes / (1024.0 * 1024.0) / seconds);
+}
+
+/* Runs the current throughput row in a new process and copies its
+ * results; the peak RSS of the row is the child's, which besides the
+ * batch only lists the corpus.
+ */
+void EngineBench::throughputInChild()
+{
+    const QString tag = QTest::currentDataTag();
+
+    QTemporaryFile results(QDir::tempPath() + "/qwatermark-bench-XXXXXX.tsv");
+    QVERIFY(results.open());
+    results.close();
+
+    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+    env.insert("QWATERMARK_BENCH_CHILD", "1");
+    env.insert("QWATERMARK_BENCH_DIR", m_dir);
+    env.insert("QWATERMARK_BENCH_RESULTS", results.fileName());
+
+    QProcess child;
+    child.setProcessEnvironment(env);
+    child.setProcessChannelMode(QProcess::ForwardedChannels);
+    child.start(QCoreApplication::applicationFilePath(), QStringList() << "throughput:" + tag);
+    QVERIFY(child.waitForFinished(-1));
+    QCOMPARE(child.exitStatus(), QProcess::NormalExit);
+    QCOMPARE(child.exitCode(), 0);
+
+    QVERIFY(results.open());
+    QTextStream in(&results);
+    double imagesPerSecond = 0;
+    while (!in.atEnd())
+    {
+        QStringList fields = in.readLine().split('\t');
+        if (fields.size() != 4)
+            continue;
+        if (fields.at(0) == "throughput" && fields.at(1) == tag)
+        {
+            result("throughput", tag, fields.at(2), fields.at(3).toDouble());
+            if (fields.at(2) == "images/s")
+                imagesPerSecond = fields.at(3).toDouble();
+        }
+        else if (fields.at(0) == "process" && fields.at(2) == "peakRssMB")
+            result("throughput", tag, "peakRssMB", fields.at(3).toDouble());
+    }
+
+    QVERIFY(imagesPerSecond > 0);
+    QTest::setBenchmarkResult(m_files.size() / imagesPerSecond * 1000, QTest::WalltimeMilliseconds);
+}
+
+int main(int argc, char *argv[])
+{
+    HeadlessApplication app(argc, argv);
+    // profiles are read from the settings, keep them apart from the user's
+    QCoreApplication::setOrganizationName("yarpen.cz");
+    QCoreApplication::setApplicationName("QWatermark-bench");
+
+    EngineBench bench;
+    return QTest::qExec(&bench, argc, argv);
+}
+
+#include "enginebench.moc"
@@ -0,0 +1,65 @@
+#include <QTextStream>
+
+#include "batchrunner.h"
+#include "watermarkengine.h"
+#include "jobqueue.h"
+
+
+static QTextStream &err()
+{
+    static QTextStream s(stderr);
+    return s;
+}
+
+BatchRunner::BatchRunner(WatermarkEngine *engine, bool verbose, QObject *parent)
+    : QObject(parent),
+      m_engine(engine),
+      m_jobs(0),
+      m_verbose(verbose),
+      m_total(0),
+      m_errCnt(0)
+{
+    connect(engine, SIGNAL(scanFinished(int)), this, SLOT(scanFinished(int)));
+    connect(engine, SIGNAL(fileStarted(QString)), this, SLOT(fileStarted(QString)));
+    connect(engine, SIGNAL(fileWritten(QString)), this, SLOT(fileWritten(QString)));
+    connect(engine, SIGNAL(error(QString,QString)), this, SLOT(error(QString,QString)));
+}
+
+void BatchRunner::scanFinished(int total)
+{
+    m_total = total;
+    if (m_verbose)
+    {
+        err() << tr("%1 files found").arg(total) << '\n';
+        err().flush();
+    }
+}
+
+void BatchRunner::fileStarted(const QString &fname)
+{
+    if (!m_verbose)
+        return;
+
+    // by pixels done, the file count says little with mixed sizes
+    QString progress = QString("%1%").arg(m_engine->progressPermille() / 10.0, 0, 'f', 1);
+    int left = m_engine->secondsLeft();
+    if (left >= 0)
+        progress += tr(", %1:%2 left").arg(left / 60).arg(left % 60, 2, 10, QChar('0'));
+    err() << '[' << progress << "] " << fname << '\n';
+    err().flush();
+}
+
+void BatchRunner::fileWritten(const QString &fname)
+{
+    if (m_jobs)
+        m_jobs->markCompleted(fname);
+}
+
+void BatchRunner::error(const QString &fname, const QString &message)
+{
+    Q_UNUSED(fname);
+
+    m_errCnt++;
+    err() << message << '\n';
+    err().flush();
+}
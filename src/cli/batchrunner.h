@@ -0,0 +1,40 @@
+#ifndef BATCHRUNNER_H
+#define BATCHRUNNER_H
+
+#include <QObject>
+
+class WatermarkEngine;
+class JobQueue;
+
+
+/*! Console front end for WatermarkEngine: prints progress and errors
+ * to stderr and counts failures for the exit status.
+ */
+class BatchRunner : public QObject
+{
+    Q_OBJECT
+
+public:
+    BatchRunner(WatermarkEngine *engine, bool verbose, QObject *parent = 0);
+
+    int total() const { return m_total; }
+    int errorCount() const { return m_errCnt; }
+
+    // journal of the running job, written files are recorded there
+    void setJobQueue(JobQueue *queue) { m_jobs = queue; }
+
+private:
+    WatermarkEngine *m_engine;
+    JobQueue *m_jobs;
+    bool m_verbose;
+    int m_total;
+    int m_errCnt;
+
+private slots:
+    void scanFinished(int total);
+    void fileStarted(const QString &fname);
+    void fileWritten(const QString &fname);
+    void error(const QString &fname, const QString &message);
+};
+
+#endif // BATCHRUNNER_H
@@ -0,0 +1,13 @@
+TEMPLATE = app
+TARGET = qwatermark-cli
+
+QT        += core gui
+CONFIG    += console
+CONFIG    -= app_bundle
+
+ENGINE_BUILD_DIR = $$OUT_PWD/../engine
+include(../engine/engine.pri)
+
+HEADERS   += batchrunner.h
+SOURCES   += main.cpp \
+    batchrunner.cpp
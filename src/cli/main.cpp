@@ -0,0 +1,351 @@
+#include <QFileInfo>
+#include <QStringList>
+#include <QTextStream>
+
+#include "headless.h"
+#include "watermarkengine.h"
+#include "profile.h"
+#include "batchrunner.h"
+#include "jobqueue.h"
+
+
+enum ExitStatus {
+    ExitOk = 0,
+    ExitUsage = 1,
+    ExitSetup = 2,
+    ExitFailures = 3
+};
+
+static void usage(QTextStream &out)
+{
+    out << "Usage: qwatermark-cli [options] <source> <destination>\n"
+           "       qwatermark-cli [options] --resume\n"
+           "       qwatermark-cli --list-jobs\n"
+           "\n"
+           "Options:\n"
+           "  -p, --profile <name>       watermark profile (default: Default)\n"
+           "      --position <pos>       upper-left, upper-center, upper-right,\n"
+           "                             center-left, center, center-right,\n"
+           "                             lower-left, lower-center, lower-right\n"
+           "                             (default: upper-left)\n"
+           "  -r, --recursive            iterate over subdirectories\n"
+           "  -i, --incremental          skip images already watermarked with the\n"
+           "                             same profile and position\n"
+           "      --format <fmt>         keep, jpeg, png or webp (default: profile)\n"
+           "      --quality <n>          JPEG and WebP quality 0..100 (default: profile)\n"
+           "      --png-compression <n>  zlib level 0..9 (default: profile)\n"
+           "      --strip-metadata       do not copy EXIF, comments and text chunks\n"
+           "      --no-jpeg-region       fully re-encode JPEGs instead of only the\n"
+           "                             blocks under the watermark\n"
+           "  -j, --threads <n>          worker threads (default: CPU count)\n"
+           "      --decode-threads <n>   decoder stage threads\n"
+           "      --composite-threads <n> compositor stage threads\n"
+           "      --encode-threads <n>   encoder stage threads\n"
+           "      --max-in-flight <n>    decoded images held in memory at once\n"
+           "      --memory-budget <mb>   memory for decoded images (default: a quarter\n"
+           "                             of the RAM); larger images are streamed\n"
+           "      --directory-order      decode in the order the files are found instead\n"
+           "                             of the largest images first\n"
+           "      --retries <n>          attempts after a failed read or write, with a\n"
+           "                             growing delay (default: 2)\n"
+           "      --max-errors <n>       stop the batch after n failed images; it stays\n"
+           "                             queued for --resume (default: never)\n"
+           "      --report <file>        write per-file and per-stage timing, CSV for\n"
+           "                             a .csv file, JSON otherwise\n"
+           "      --job <name>           name of the batch job; every batch is kept as\n"
+           "                             a job until it finishes and can be resumed\n"
+           "      --queue                only add the job to the queue, do not run it\n"
+           "      --resume               run the queued and interrupted jobs, oldest\n"
+           "                             first, skipping files they already wrote\n"
+           "      --list-jobs            print the queued and interrupted jobs\n"
+           "  -v, --verbose              print every processed file and a timing\n"
+           "                             summary\n"
+           "  -h, --help                 show this help\n"
+           "\n"
+           "Exit status: 0 success, 1 usage error, 2 invalid profile or folders,\n"
+           "3 some images could not be processed.\n";
+    out.flush();
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication::setApplicationName("QWatermark");
+    QCoreApplication::setApplicationVersion("0.1");
+    QCoreApplication::setOrganizationName("yarpen.cz");
+    QCoreApplication::setOrganizationDomain("yarpen.cz");
+
+    HeadlessApplication app(argc, argv);
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    QString profileName = "Default";
+    WatermarkEngine::Position position = WatermarkEngine::UpperLeft;
+    bool recursive = false;
+    bool incremental = false;
+    bool jpegRegion = true;
+    QString format;
+    int quality = -1;
+    int pngCompression = -1;
+    bool stripMetadata = false;
+    bool verbose = false;
+    int threads = 0;
+    int decodeThreads = 0;
+    int compositeThreads = 0;
+    int encodeThreads = 0;
+    int maxInFlight = 0;
+    int memoryBudget = 0;
+    bool largestFirst = true;
+    int retries = 2;
+    int maxErrors = 0;
+    QString report;
+    QString jobName;
+    bool queueOnly = false;
+    bool resume = false;
+    bool listJobs = false;
+    QStringList paths;
+
+    QStringList args = app.arguments();
+    args.removeFirst();
+    while (!args.isEmpty())
+    {
+        QString a = args.takeFirst();
+        bool ok = true;
+
+        if (a == "-h" || a == "--help")
+        {
+            usage(out);
+            return ExitOk;
+        }
+        else if (a == "-r" || a == "--recursive")
+            recursive = true;
+        else if (a == "-i" || a == "--incremental")
+            incremental = true;
+        else if (a == "--directory-order")
+            largestFirst = false;
+        else if (a == "--no-jpeg-region")
+            jpegRegion = false;
+        else if (a == "--strip-metadata")
+            stripMetadata = true;
+        else if (a == "-v" || a == "--verbose")
+            verbose = true;
+        else if (a == "--queue")
+            queueOnly = true;
+        else if (a == "--resume")
+            resume = true;
+        else if (a == "--list-jobs")
+            listJobs = true;
+        else if (a.startsWith('-') && args.isEmpty())
+            ok = false;
+        else if (a == "-p" || a == "--profile")
+            profileName = args.takeFirst();
+        else if (a == "--position")
+            position = WatermarkEngine::positionFromName(args.takeFirst(), &ok);
+        else if (a == "--format")
+        {
+            format = args.takeFirst();
+            Profile::formatFromName(format, &ok);
+        }
+        else if (a == "--quality")
+        {
+            quality = args.takeFirst().toInt(&ok);
+            ok = ok && quality >= 0 && quality <= 100;
+        }
+        else if (a == "--png-compression")
+        {
+            pngCompression = args.takeFirst().toInt(&ok);
+            ok = ok && pngCompression >= 0 && pngCompression <= 9;
+        }
+        else if (a == "-j" || a == "--threads")
+            threads = args.takeFirst().toInt(&ok);
+        else if (a == "--decode-threads")
+            decodeThreads = args.takeFirst().toInt(&ok);
+        else if (a == "--composite-threads")
+            compositeThreads = args.takeFirst().toInt(&ok);
+        else if (a == "--encode-threads")
+            encodeThreads = args.takeFirst().toInt(&ok);
+        else if (a == "--max-in-flight")
+            maxInFlight = args.takeFirst().toInt(&ok);
+        else if (a == "--memory-budget")
+            memoryBudget = args.takeFirst().toInt(&ok);
+        else if (a == "--retries")
+            retries = args.takeFirst().toInt(&ok);
+        else if (a == "--max-errors")
+            maxErrors = args.takeFirst().toInt(&ok);
+        else if (a == "--report")
+            report = args.takeFirst();
+        else if (a == "--job")
+            jobName = args.takeFirst();
+        else if (a.startsWith('-'))
+            ok = false;
+        else
+            paths << a;
+
+        if (!ok)
+        {
+            err << "Invalid argument: " << a << '\n';
+            usage(err);
+            return ExitUsage;
+        }
+    }
+
+    JobQueue queue;
+    QList<BatchJob> jobs;
+
+    if (listJobs)
+    {
+        foreach (const BatchJob &job, queue.jobs())
+        {
+            out << job.id << '\t' << job.name << '\t'
+                << (job.state == BatchJob::Queued ? "queued" : "interrupted") << '\t'
+                << job.sourcePath << " -> " << job.destinationPath << '\n';
+        }
+        out.flush();
+        return ExitOk;
+    }
+
+    if (resume)
+    {
+        if (!paths.isEmpty() || queueOnly)
+        {
+            usage(err);
+            return ExitUsage;
+        }
+        jobs = queue.jobs();
+    }
+    else
+    {
+        if (paths.size() != 2)
+        {
+            usage(err);
+            return ExitUsage;
+        }
+
+        BatchJob job;
+        job.name = jobName;
+        job.sourcePath = paths.at(0);
+        job.destinationPath = paths.at(1);
+        job.profile = profileName;
+        job.position = position;
+        job.recursive = recursive;
+        job.incremental = incremental;
+        job.jpegRegion = jpegRegion;
+        job.format = format;
+        job.quality = quality;
+        job.pngCompression = pngCompression;
+        job.stripMetadata = stripMetadata;
+
+        // checked before the job is queued, a broken one would stay there
+        WatermarkEngine check;
+        QString errorString;
+        if (!job.apply(&check, &errorString))
+        {
+            err << errorString << '\n';
+            err.flush();
+            return ExitSetup;
+        }
+        if (!QFileInfo(job.sourcePath).isDir() || !QFileInfo(job.destinationPath).isDir())
+        {
+            err << "Source and destination must be existing folders" << '\n';
+            err.flush();
+            return ExitSetup;
+        }
+
+        if (!queue.add(&job))
+        {
+            err << "Cannot store the job in " << JobQueue::defaultDir() << ", it cannot be resumed" << '\n';
+            err.flush();
+        }
+        if (queueOnly)
+        {
+            out << job.id << '\n';
+            out.flush();
+            return ExitOk;
+        }
+        jobs << job;
+    }
+
+    WatermarkEngine engine;
+    engine.setThreadCount(threads);
+    if (decodeThreads)
+        engine.setDecodeThreads(decodeThreads);
+    if (compositeThreads)
+        engine.setCompositeThreads(compositeThreads);
+    if (encodeThreads)
+        engine.setEncodeThreads(encodeThreads);
+    if (maxInFlight)
+        engine.setMaxInFlight(maxInFlight);
+    engine.setMemoryBudget(qint64(memoryBudget) * 1024 * 1024);
+    engine.setLargestFirst(largestFirst);
+    engine.setRetries(retries);
+    engine.setMaxErrors(maxErrors);
+
+    BatchRunner runner(&engine, verbose);
+    runner.setJobQueue(&queue);
+    QObject::connect(&engine, SIGNAL(finished()), &app, SLOT(quit()));
+
+    int status = ExitOk;
+    for (int i = 0; i < jobs.size(); ++i)
+    {
+        BatchJob &job = jobs[i];
+
+        QString errorString;
+        if (!job.apply(&engine, &errorString))
+        {
+            err << job.name << ": " << errorString << '\n';
+            err.flush();
+            status = ExitSetup;
+            continue;
+        }
+        if (verbose)
+        {
+            err << "Job " << job.name << '\n';
+            err.flush();
+        }
+
+        // an interrupted job goes on where it stopped
+        engine.setCompletedFiles(queue.completed(job));
+        job.state = BatchJob::Running;
+        queue.save(job);
+        queue.begin(job);
+
+        engine.start();
+        if (engine.isRunning())
+            app.exec();
+
+        queue.end();
+        if (engine.tooManyErrors())
+        {
+            err << job.name << ": stopped after " << engine.errorCount() << " errors" << '\n';
+            err.flush();
+            job.state = BatchJob::Interrupted;
+            queue.save(job);
+        }
+        else
+            queue.finish(job);
+
+        if (verbose)
+        {
+            err << runner.total() << " files, " << engine.skippedCount() << " unchanged or already done, "
+                << runner.errorCount() << " errors" << '\n';
+            err << engine.stats().summary() << '\n';
+            err.flush();
+        }
+
+        // of the last job when resuming several
+        if (!report.isEmpty() && !engine.stats().save(report, &errorString))
+        {
+            err << "Cannot write the report " << report << ": " << errorString << '\n';
+            err.flush();
+            status = ExitFailures;
+        }
+
+        // the rest would most likely fail the same way
+        if (engine.tooManyErrors())
+            break;
+    }
+
+    if (status != ExitOk)
+        return status;
+    return runner.errorCount() ? ExitFailures : ExitOk;
+}
@@ -0,0 +1,348 @@
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QStringList>
+#include <QVector>
+#include <QtAlgorithms>
+
+#include "batchstats.h"
+
+
+BatchStats::Record::Record()
+    : status(Ignored),
+      bytesIn(0),
+      bytesOut(0),
+      waitUsecs(0),
+      retries(0)
+{
+    for (int i = 0; i < StageCount; ++i)
+        usecs[i] = 0;
+}
+
+BatchStats::BatchStats()
+    : m_elapsedUsecs(-1),
+      m_scanUsecs(0)
+{
+    m_clock.start();
+}
+
+QString BatchStats::stageName(Stage stage)
+{
+    switch (stage)
+    {
+    case Decode:
+        return "decode";
+    case Prepare:
+        return "prepare";
+    case Composite:
+        return "composite";
+    case Encode:
+        return "encode";
+    case Write:
+        return "write";
+    case StageCount:
+        break;
+    }
+    return QString();
+}
+
+QString BatchStats::statusName(Status status)
+{
+    switch (status)
+    {
+    case Written:
+        return "written";
+    case Skipped:
+        return "skipped";
+    case Failed:
+        return "failed";
+    case Ignored:
+        return "ignored";
+    }
+    return QString();
+}
+
+void BatchStats::reset()
+{
+    QMutexLocker locker(&m_mutex);
+    m_records.clear();
+    m_elapsedUsecs = -1;
+    m_scanUsecs = 0;
+    m_clock.restart();
+}
+
+void BatchStats::finish()
+{
+    QMutexLocker locker(&m_mutex);
+    m_elapsedUsecs = now();
+}
+
+void BatchStats::setScanUsecs(qint64 usecs)
+{
+    QMutexLocker locker(&m_mutex);
+    m_scanUsecs = usecs;
+}
+
+void BatchStats::add(const Record &record)
+{
+    QMutexLocker locker(&m_mutex);
+    m_records.append(record);
+}
+
+int BatchStats::count(Status status) const
+{
+    QMutexLocker locker(&m_mutex);
+    int c = 0;
+    foreach (const Record &r, m_records)
+    {
+        if (r.status == status)
+            ++c;
+    }
+    return c;
+}
+
+QStringList BatchStats::errors() const
+{
+    QMutexLocker locker(&m_mutex);
+    QStringList l;
+    foreach (const Record &r, m_records)
+    {
+        if (r.status == Failed && !r.error.isEmpty())
+            l << r.error;
+    }
+    return l;
+}
+
+
+namespace {
+
+struct Percentiles {
+    Percentiles() : count(0), total(0), mean(0), p50(0), p90(0), p99(0), max(0) {}
+    int count;
+    qint64 total;
+    qint64 mean;
+    qint64 p50;
+    qint64 p90;
+    qint64 p99;
+    qint64 max;
+};
+
+// what the report is computed from, taken under the lock
+struct Totals {
+    QList<BatchStats::Record> records;
+    qint64 elapsedUsecs;
+    qint64 scanUsecs;
+    int counts[4];
+    qint64 bytesIn;
+    qint64 bytesOut;
+
+    double seconds() const { return qMax(elapsedUsecs, qint64(1)) / 1e6; }
+};
+
+}
+
+// nearest rank over the written files, stage < 0 for the queue wait
+static Percentiles percentiles(const QList<BatchStats::Record> &records, int stage)
+{
+    QVector<qint64> v;
+    v.reserve(records.size());
+    foreach (const BatchStats::Record &r, records)
+    {
+        if (r.status == BatchStats::Written)
+            v << (stage < 0 ? r.waitUsecs : r.usecs[stage]);
+    }
+
+    Percentiles p;
+    if (v.isEmpty())
+        return p;
+
+    qSort(v);
+    p.count = v.size();
+    foreach (qint64 t, v)
+        p.total += t;
+    p.mean = p.total / p.count;
+    p.p50 = v.at((p.count - 1) * 50 / 100);
+    p.p90 = v.at((p.count - 1) * 90 / 100);
+    p.p99 = v.at((p.count - 1) * 99 / 100);
+    p.max = v.last();
+    return p;
+}
+
+static Totals totals(const QList<BatchStats::Record> &records, qint64 elapsedUsecs, qint64 scanUsecs)
+{
+    Totals t;
+    t.records = records;
+    t.elapsedUsecs = elapsedUsecs;
+    t.scanUsecs = scanUsecs;
+    t.bytesIn = 0;
+    t.bytesOut = 0;
+    for (int i = 0; i < 4; ++i)
+        t.counts[i] = 0;
+
+    foreach (const BatchStats::Record &r, records)
+    {
+        ++t.counts[r.status];
+        if (r.status == BatchStats::Written)
+        {
+            t.bytesIn += r.bytesIn;
+            t.bytesOut += r.bytesOut;
+        }
+    }
+    return t;
+}
+
+static QString ms(qint64 usecs)
+{
+    return QString::number(usecs / 1000.0, 'f', 3);
+}
+
+static QString mbPerSecond(qint64 bytes, double seconds)
+{
+    return QString::number(bytes / (1024.0 * 1024.0) / seconds, 'f', 2);
+}
+
+static QString jsonString(const QString &s)
+{
+    QString ret = "\"";
+    foreach (QChar c, s)
+    {
+        if (c == '"' || c == '\\')
+            ret += '\\' + QString(c);
+        else if (c.unicode() < 0x20)
+            ret += QString("\\u%1").arg(c.unicode(), 4, 16, QChar('0'));
+        else
+            ret += c;
+    }
+    return ret + '"';
+}
+
+static QString csvField(const QString &s)
+{
+    if (!s.contains(',') && !s.contains('"') && !s.contains('\n'))
+        return s;
+    QString ret = s;
+    ret.replace("\"", "\"\"");
+    return '"' + ret + '"';
+}
+
+QString BatchStats::summary() const
+{
+    m_mutex.lock();
+    Totals t = totals(m_records, m_elapsedUsecs >= 0 ? m_elapsedUsecs : now(), m_scanUsecs);
+    m_mutex.unlock();
+
+    QStringList lines;
+    lines << QString("%1 written, %2 skipped, %3 failed in %4 s")
+             .arg(t.counts[Written]).arg(t.counts[Skipped]).arg(t.counts[Failed])
+             .arg(QString::number(t.seconds(), 'f', 2));
+    lines << QString("%1 images/s, %2 MB/s read, %3 MB/s written")
+             .arg(QString::number(t.counts[Written] / t.seconds(), 'f', 2))
+             .arg(mbPerSecond(t.bytesIn, t.seconds()))
+             .arg(mbPerSecond(t.bytesOut, t.seconds()));
+    lines << QString("scan: %1 ms").arg(ms(t.scanUsecs));
+
+    for (int stage = -1; stage < StageCount; ++stage)
+    {
+        Percentiles p = percentiles(t.records, stage);
+        lines << QString("%1: mean %2 ms, p50 %3 ms, p90 %4 ms, p99 %5 ms, max %6 ms")
+                 .arg(stage < 0 ? QString("queue wait") : stageName(Stage(stage)))
+                 .arg(ms(p.mean)).arg(ms(p.p50)).arg(ms(p.p90)).arg(ms(p.p99)).arg(ms(p.max));
+    }
+
+    return lines.join("\n");
+}
+
+QByteArray BatchStats::toJson() const
+{
+    m_mutex.lock();
+    Totals t = totals(m_records, m_elapsedUsecs >= 0 ? m_elapsedUsecs : now(), m_scanUsecs);
+    m_mutex.unlock();
+
+    QStringList out;
+    out << "{";
+    out << QString("  \"files\": %1,").arg(t.records.size());
+    for (int s = Written; s <= Ignored; ++s)
+        out << QString("  \"%1\": %2,").arg(statusName(Status(s))).arg(t.counts[s]);
+    out << QString("  \"elapsedMs\": %1,").arg(ms(t.elapsedUsecs));
+    out << QString("  \"scanMs\": %1,").arg(ms(t.scanUsecs));
+    out << QString("  \"bytesIn\": %1,").arg(t.bytesIn);
+    out << QString("  \"bytesOut\": %1,").arg(t.bytesOut);
+    out << QString("  \"imagesPerSecond\": %1,").arg(QString::number(t.counts[Written] / t.seconds(), 'f', 3));
+    out << QString("  \"readMBPerSecond\": %1,").arg(mbPerSecond(t.bytesIn, t.seconds()));
+    out << QString("  \"writtenMBPerSecond\": %1,").arg(mbPerSecond(t.bytesOut, t.seconds()));
+
+    out << "  \"stages\": {";
+    for (int stage = -1; stage < StageCount; ++stage)
+    {
+        Percentiles p = percentiles(t.records, stage);
+        out << QString("    %1: {\"count\": %2, \"totalMs\": %3, \"meanMs\": %4, \"p50Ms\": %5, "
+                       "\"p90Ms\": %6, \"p99Ms\": %7, \"maxMs\": %8}%9")
+               .arg(jsonString(stage < 0 ? QString("wait") : stageName(Stage(stage))))
+               .arg(p.count).arg(ms(p.total)).arg(ms(p.mean)).arg(ms(p.p50))
+               .arg(ms(p.p90)).arg(ms(p.p99)).arg(ms(p.max))
+               .arg(stage + 1 < StageCount ? "," : "");
+    }
+    out << "  },";
+
+    out << "  \"records\": [";
+    for (int i = 0; i < t.records.size(); ++i)
+    {
+        const Record &r = t.records.at(i);
+        QString line = QString("    {\"source\": %1, \"status\": \"%2\", \"bytesIn\": %3, \"bytesOut\": %4, \"waitMs\": %5, \"retries\": %6")
+                       .arg(jsonString(r.source)).arg(statusName(r.status))
+                       .arg(r.bytesIn).arg(r.bytesOut).arg(ms(r.waitUsecs)).arg(r.retries);
+        for (int stage = 0; stage < StageCount; ++stage)
+            line += QString(", \"%1Ms\": %2").arg(stageName(Stage(stage))).arg(ms(r.usecs[stage]));
+        if (!r.error.isEmpty())
+            line += ", \"error\": " + jsonString(r.error);
+        out << line + (i + 1 < t.records.size() ? "}," : "}");
+    }
+    out << "  ]";
+    out << "}";
+
+    return out.join("\n").toUtf8() + '\n';
+}
+
+QByteArray BatchStats::toCsv() const
+{
+    m_mutex.lock();
+    QList<Record> records = m_records;
+    m_mutex.unlock();
+
+    QStringList out;
+    QString header = "source,status,bytes_in,bytes_out,wait_ms,retries";
+    for (int stage = 0; stage < StageCount; ++stage)
+        header += ',' + stageName(Stage(stage)) + "_ms";
+    header += ",error";
+    out << header;
+
+    foreach (const Record &r, records)
+    {
+        QString line = QString("%1,%2,%3,%4,%5,%6").arg(csvField(r.source)).arg(statusName(r.status))
+                       .arg(r.bytesIn).arg(r.bytesOut).arg(ms(r.waitUsecs)).arg(r.retries);
+        for (int stage = 0; stage < StageCount; ++stage)
+            line += ',' + ms(r.usecs[stage]);
+        line += ',' + csvField(r.error);
+        out << line;
+    }
+
+    return out.join("\n").toUtf8() + '\n';
+}
+
+bool BatchStats::save(const QString &fileName, QString *errorString) const
+{
+    QFile f(fileName);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        *errorString = f.errorString();
+        return false;
+    }
+
+    QByteArray data = QFileInfo(fileName).suffix().toLower() == "csv" ? toCsv() : toJson();
+    if (f.write(data) != data.size())
+    {
+        *errorString = f.errorString();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,88 @@
+#ifndef BATCHSTATS_H
+#define BATCHSTATS_H
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+
+
+/*! Timing of one batch run, collected by the engine's stage loops.
+ *
+ * Every file gets a Record with the time spent in each stage, the time
+ * it waited in the queues between them and the bytes read and written.
+ * At the end the records are summarized into percentiles per stage and
+ * the overall throughput, written as JSON (summary and records) or CSV
+ * (one row per file). All methods are thread safe.
+ */
+class BatchStats
+{
+public:
+
+    enum Stage {
+        Decode,
+        Prepare,
+        Composite,
+        Encode,
+        Write,
+        StageCount
+    };
+
+    enum Status {
+        Written,
+        Skipped,
+        Failed,
+        Ignored
+    };
+
+    struct Record {
+        Record();
+        QString source;
+        Status status;
+        // why a Failed image failed
+        QString error;
+        qint64 bytesIn;
+        qint64 bytesOut;
+        // time queued between the stages, including backpressure
+        qint64 waitUsecs;
+        // reads and writes tried again after transient errors
+        int retries;
+        qint64 usecs[StageCount];
+    };
+
+    BatchStats();
+
+    static QString stageName(Stage stage);
+    static QString statusName(Status status);
+
+    // clears the records and starts the batch clock
+    void reset();
+    void finish();
+    // microseconds since reset()
+    qint64 now() const { return m_clock.nsecsElapsed() / 1000; }
+
+    void setScanUsecs(qint64 usecs);
+    void add(const Record &record);
+
+    int count(Status status) const;
+    // messages of the failed images, in the order they failed
+    QStringList errors() const;
+
+    // a few lines for people, see save() for machines
+    QString summary() const;
+    QByteArray toJson() const;
+    QByteArray toCsv() const;
+    // CSV for a .csv file name, JSON otherwise
+    bool save(const QString &fileName, QString *errorString) const;
+
+private:
+    mutable QMutex m_mutex;
+    QElapsedTimer m_clock;
+    qint64 m_elapsedUsecs;
+    qint64 m_scanUsecs;
+    QList<Record> m_records;
+};
+
+#endif // BATCHSTATS_H
@@ -0,0 +1,273 @@
+#include <QVarLengthArray>
+
+#include "blend.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define QWATERMARK_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+
+/* All kernels compute, per channel,
+ *
+ *     s = BYTE_MUL(src, constAlpha)
+ *     dst = s + BYTE_MUL(dst, 255 - alpha(s))
+ *
+ * with BYTE_MUL(c, a) = (c*a + ((c*a) >> 8) + 0x80) >> 8, which is what
+ * Qt's raster engine does for SourceOver with a constant opacity. For
+ * constAlpha 255 it also degrades to Qt's opaque/transparent shortcuts.
+ */
+typedef void (*BlendRowFunc)(quint32 *dst, const quint32 *src, int n, uint constAlpha);
+
+static inline uint byteMul(uint x, uint a)
+{
+    uint t = (x & 0xff00ff) * a;
+    t = (t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8;
+    t &= 0xff00ff;
+
+    x = ((x >> 8) & 0xff00ff) * a;
+    x = (x + ((x >> 8) & 0xff00ff) + 0x800080);
+    x &= 0xff00ff00;
+    return x | t;
+}
+
+static void blendRowScalar(quint32 *dst, const quint32 *src, int n, uint constAlpha)
+{
+    for (int i = 0; i < n; ++i)
+    {
+        uint s = src[i];
+        if (constAlpha != 255)
+            s = byteMul(s, constAlpha);
+        if (s >= 0xff000000)
+            dst[i] = s;
+        else if (s != 0)
+            dst[i] = s + byteMul(dst[i], (~s) >> 24);
+    }
+}
+
+#ifdef QWATERMARK_X86_KERNELS
+
+__attribute__((target("sse2")))
+static inline __m128i byteMulSse2(__m128i x16, __m128i a16)
+{
+    __m128i t = _mm_mullo_epi16(x16, a16);
+    t = _mm_add_epi16(t, _mm_srli_epi16(t, 8));
+    t = _mm_add_epi16(t, _mm_set1_epi16(0x80));
+    return _mm_srli_epi16(t, 8);
+}
+
+// two pixels as 16 bit lanes -> each pixel's 255 - alpha broadcast to its four lanes
+__attribute__((target("sse2")))
+static inline __m128i invAlphaSse2(__m128i s16)
+{
+    __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s16, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm_xor_si128(a, _mm_set1_epi16(0xff));
+}
+
+__attribute__((target("sse2")))
+static void blendRowSse2(quint32 *dst, const quint32 *src, int n, uint constAlpha)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ca = _mm_set1_epi16(constAlpha);
+
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        // fully transparent run, nothing to do
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, zero)) == 0xffff)
+            continue;
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+
+        __m128i sLo = _mm_unpacklo_epi8(s, zero);
+        __m128i sHi = _mm_unpackhi_epi8(s, zero);
+        if (constAlpha != 255)
+        {
+            sLo = byteMulSse2(sLo, ca);
+            sHi = byteMulSse2(sHi, ca);
+        }
+
+        __m128i dLo = byteMulSse2(_mm_unpacklo_epi8(d, zero), invAlphaSse2(sLo));
+        __m128i dHi = byteMulSse2(_mm_unpackhi_epi8(d, zero), invAlphaSse2(sHi));
+
+        __m128i r = _mm_add_epi8(_mm_packus_epi16(sLo, sHi), _mm_packus_epi16(dLo, dHi));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), r);
+    }
+
+    blendRowScalar(dst + i, src + i, n - i, constAlpha);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i byteMulAvx2(__m256i x16, __m256i a16)
+{
+    __m256i t = _mm256_mullo_epi16(x16, a16);
+    t = _mm256_add_epi16(t, _mm256_srli_epi16(t, 8));
+    t = _mm256_add_epi16(t, _mm256_set1_epi16(0x80));
+    return _mm256_srli_epi16(t, 8);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i invAlphaAvx2(__m256i s16)
+{
+    __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s16, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm256_xor_si256(a, _mm256_set1_epi16(0xff));
+}
+
+__attribute__((target("avx2")))
+static void blendRowAvx2(quint32 *dst, const quint32 *src, int n, uint constAlpha)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ca = _mm256_set1_epi16(constAlpha);
+
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        if (_mm256_testz_si256(s, s))
+            continue;
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+
+        // unpack/pack work within 128 bit lanes, so pixel order is kept
+        __m256i sLo = _mm256_unpacklo_epi8(s, zero);
+        __m256i sHi = _mm256_unpackhi_epi8(s, zero);
+        if (constAlpha != 255)
+        {
+            sLo = byteMulAvx2(sLo, ca);
+            sHi = byteMulAvx2(sHi, ca);
+        }
+
+        __m256i dLo = byteMulAvx2(_mm256_unpacklo_epi8(d, zero), invAlphaAvx2(sLo));
+        __m256i dHi = byteMulAvx2(_mm256_unpackhi_epi8(d, zero), invAlphaAvx2(sHi));
+
+        __m256i r = _mm256_add_epi8(_mm256_packus_epi16(sLo, sHi), _mm256_packus_epi16(dLo, dHi));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), r);
+    }
+
+    blendRowSse2(dst + i, src + i, n - i, constAlpha);
+}
+
+#endif // QWATERMARK_X86_KERNELS
+
+struct BlendKernel
+{
+    const char *name;
+    BlendRowFunc func;
+};
+
+// fastest first
+static const BlendKernel s_kernels[] = {
+#ifdef QWATERMARK_X86_KERNELS
+    { "avx2", blendRowAvx2 },
+    { "sse2", blendRowSse2 },
+#endif
+    { "scalar", blendRowScalar }
+};
+static const int s_kernelCount = sizeof(s_kernels) / sizeof(s_kernels[0]);
+
+static bool kernelSupported(const BlendKernel &k)
+{
+#ifdef QWATERMARK_X86_KERNELS
+    __builtin_cpu_init();
+    if (k.func == blendRowAvx2)
+        return __builtin_cpu_supports("avx2");
+    if (k.func == blendRowSse2)
+        return __builtin_cpu_supports("sse2");
+#else
+    Q_UNUSED(k);
+#endif
+    return true;
+}
+
+static const BlendKernel *selectKernel()
+{
+    for (int i = 0; i < s_kernelCount; ++i)
+    {
+        if (kernelSupported(s_kernels[i]))
+            return &s_kernels[i];
+    }
+    return &s_kernels[s_kernelCount - 1];
+}
+
+static const BlendKernel *s_kernel = selectKernel();
+
+const char *blendKernelName()
+{
+    return s_kernel->name;
+}
+
+QStringList blendKernels()
+{
+    QStringList l;
+    for (int i = 0; i < s_kernelCount; ++i)
+    {
+        if (kernelSupported(s_kernels[i]))
+            l << QLatin1String(s_kernels[i].name);
+    }
+    return l;
+}
+
+bool setBlendKernel(const QString &name)
+{
+    for (int i = 0; i < s_kernelCount; ++i)
+    {
+        if (name == QLatin1String(s_kernels[i].name) && kernelSupported(s_kernels[i]))
+        {
+            s_kernel = &s_kernels[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+// RGB888 is opaque, so blending its pixels as 0xffRRGGBB and dropping the alpha again is exact
+static void blendRowRgb888(uchar *dst, const quint32 *src, int n, uint constAlpha)
+{
+    QVarLengthArray<quint32, 2048> row(n);
+    for (int i = 0; i < n; ++i)
+        row[i] = 0xff000000 | (uint(dst[3 * i]) << 16) | (uint(dst[3 * i + 1]) << 8) | dst[3 * i + 2];
+
+    s_kernel->func(row.data(), src, n, constAlpha);
+
+    for (int i = 0; i < n; ++i)
+    {
+        dst[3 * i] = row[i] >> 16;
+        dst[3 * i + 1] = row[i] >> 8;
+        dst[3 * i + 2] = row[i];
+    }
+}
+
+bool blendSprite(QImage *dst, int x, int y, const QImage &sprite, qreal opacity)
+{
+    if (sprite.format() != QImage::Format_ARGB32_Premultiplied)
+        return false;
+    const bool rgb888 = dst->format() == QImage::Format_RGB888;
+    if (dst->format() != QImage::Format_RGB32 && dst->format() != QImage::Format_ARGB32_Premultiplied && !rgb888)
+        return false;
+
+    // QPainter keeps opacity as qRound(opacity * 256) and scales it to 0..255
+    int constAlpha = qRound(qBound(qreal(0), opacity, qreal(1)) * 256);
+    constAlpha = (constAlpha * 255) >> 8;
+    if (constAlpha == 0)
+        return true;
+
+    QRect r = QRect(x, y, sprite.width(), sprite.height()) & dst->rect();
+    if (r.isEmpty())
+        return true;
+
+    const int sx = r.x() - x;
+    const int sy = r.y() - y;
+
+    for (int row = 0; row < r.height(); ++row)
+    {
+        const quint32 *s = reinterpret_cast<const quint32 *>(sprite.constScanLine(sy + row)) + sx;
+        if (rgb888)
+        {
+            blendRowRgb888(dst->scanLine(r.y() + row) + 3 * r.x(), s, r.width(), constAlpha);
+            continue;
+        }
+        quint32 *d = reinterpret_cast<quint32 *>(dst->scanLine(r.y() + row)) + r.x();
+        s_kernel->func(d, s, r.width(), constAlpha);
+    }
+
+    return true;
+}
@@ -0,0 +1,34 @@
+#ifndef BLEND_H
+#define BLEND_H
+
+#include <QImage>
+#include <QStringList>
+
+
+/*! Composite a premultiplied ARGB32 sprite over dst at (x, y) with a
+ * constant opacity, clipped to dst.
+ *
+ * The result is bit-identical to QPainter::drawImage() after
+ * QPainter::setOpacity() for RGB32, ARGB32_Premultiplied and RGB888
+ * targets, it just skips the raster engine setup and uses SSE2 or AVX2
+ * when the CPU has them. RGB888 rows go through a 32 bit row buffer.
+ * Returns false (and leaves dst untouched) for any other format
+ * combination so the caller can fall back to QPainter.
+ */
+bool blendSprite(QImage *dst, int x, int y, const QImage &sprite, qreal opacity);
+
+/*! Name of the row kernel selected for this CPU ("avx2", "sse2" or "scalar").
+ */
+const char *blendKernelName();
+
+/*! The row kernels this build can run on this CPU, fastest first.
+ */
+QStringList blendKernels();
+
+/*! Use the named row kernel from now on, e.g. "scalar" to rule out the
+ * SIMD paths. False for a kernel blendKernels() does not list. Not
+ * thread safe, meant for tests and benchmarks.
+ */
+bool setBlendKernel(const QString &name);
+
+#endif // BLEND_H
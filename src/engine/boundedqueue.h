@@ -0,0 +1,170 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QQueue>
+#include <QtAlgorithms>
+#include <QWaitCondition>
+
+
+/*! Blocking FIFO shared by the pipeline stages.
+ *
+ * push() blocks while the queue holds capacity items (capacity <= 0
+ * means unbounded), pop() blocks while it is empty. Once close() is
+ * called, pending items can still be popped but push() fails and pop()
+ * returns false as soon as the queue runs dry.
+ *
+ * With setOrder() the queue becomes a priority queue, items that
+ * compare equal keep their FIFO order.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+    // what the function passed to pop() says about an item
+    enum Admission {
+        Take,
+        // leave it queued, look at the next one
+        Skip,
+        // leave it and all behind it queued until wake()
+        Wait
+    };
+
+    typedef bool (*LessThan)(const T &, const T &);
+
+    BoundedQueue(int capacity = 0)
+        : m_capacity(capacity),
+          m_closed(false),
+          m_lessThan(0)
+    {
+    }
+
+    // lessThan(a, b) puts a before b, 0 for a plain FIFO
+    void setOrder(LessThan lessThan)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_lessThan = lessThan;
+    }
+
+    void reset(int capacity)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_queue.clear();
+        m_capacity = capacity;
+        m_closed = false;
+    }
+
+    bool push(const T &item)
+    {
+        QMutexLocker locker(&m_mutex);
+        while (!m_closed && m_capacity > 0 && m_queue.size() >= m_capacity)
+            m_notFull.wait(&m_mutex);
+        if (m_closed)
+            return false;
+        if (m_lessThan)
+            m_queue.insert(qUpperBound(m_queue.begin(), m_queue.end(), item, m_lessThan), item);
+        else
+            m_queue.enqueue(item);
+        m_notEmpty.wakeOne();
+        return true;
+    }
+
+    /* Puts back an item popped before, e.g. one that could not be
+     * processed yet. Unlike push() it ignores the capacity and works
+     * after close(), the caller is still popping and takes it again.
+     */
+    void requeue(const T &item)
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_lessThan)
+            m_queue.insert(qUpperBound(m_queue.begin(), m_queue.end(), item, m_lessThan), item);
+        else
+            m_queue.enqueue(item);
+        m_notEmpty.wakeAll();
+    }
+
+    bool pop(T *item)
+    {
+        QMutexLocker locker(&m_mutex);
+        while (!m_closed && m_queue.isEmpty())
+            m_notEmpty.wait(&m_mutex);
+        if (m_queue.isEmpty())
+            return false;
+        *item = m_queue.dequeue();
+        m_notFull.wakeOne();
+        return true;
+    }
+
+    /* Takes the first item admit(T *) returns Take for, waiting while
+     * there is none. admit() runs with the queue locked and may modify
+     * the items it is shown; whatever else it depends on has to call
+     * wake() when it changes.
+     */
+    template <typename Admit>
+    bool pop(T *item, Admit admit)
+    {
+        QMutexLocker locker(&m_mutex);
+        for (;;)
+        {
+            if (m_closed && m_queue.isEmpty())
+                return false;
+
+            for (int i = 0; i < m_queue.size(); ++i)
+            {
+                Admission a = admit(&m_queue[i]);
+                if (a == Take)
+                {
+                    *item = m_queue.takeAt(i);
+                    m_notFull.wakeOne();
+                    return true;
+                }
+                if (a == Wait)
+                    break;
+            }
+            m_notEmpty.wait(&m_mutex);
+        }
+    }
+
+    // lets pop(T *, Admit) look at the queued items again
+    void wake()
+    {
+        QMutexLocker locker(&m_mutex);
+        m_notEmpty.wakeAll();
+    }
+
+    void close()
+    {
+        QMutexLocker locker(&m_mutex);
+        m_closed = true;
+        m_notEmpty.wakeAll();
+        m_notFull.wakeAll();
+    }
+
+    // copies the index-th item still queued, without taking it
+    bool peek(int index, T *item) const
+    {
+        QMutexLocker locker(&m_mutex);
+        if (index < 0 || index >= m_queue.size())
+            return false;
+        *item = m_queue.at(index);
+        return true;
+    }
+
+    int size() const
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_queue.size();
+    }
+
+private:
+    mutable QMutex m_mutex;
+    QWaitCondition m_notEmpty;
+    QWaitCondition m_notFull;
+    QQueue<T> m_queue;
+    int m_capacity;
+    bool m_closed;
+    LessThan m_lessThan;
+};
+
+#endif // BOUNDEDQUEUE_H
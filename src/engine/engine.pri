@@ -0,0 +1,10 @@
+# Link against the watermark engine library.
+# ENGINE_BUILD_DIR is the engine's build directory relative to the including project.
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+LIBS += -L$$ENGINE_BUILD_DIR -lqwatermarkengine
+unix:PRE_TARGETDEPS += $$ENGINE_BUILD_DIR/libqwatermarkengine.a
+!no_libjpeg:LIBS += -ljpeg
+!no_zlib:LIBS += -lz
@@ -0,0 +1,49 @@
+TEMPLATE = lib
+TARGET = qwatermarkengine
+CONFIG += staticlib
+
+# no widgets here: the engine is shared by the GUI and the command line tool
+QT        += core gui
+
+HEADERS   += profile.h \
+    profileregistry.h \
+    jobqueue.h \
+    watermarkengine.h \
+    boundedqueue.h \
+    blend.h \
+    manifest.h \
+    jpegregion.h \
+    jpegsupport.h \
+    pngencoder.h \
+    memorybudget.h \
+    mappedfile.h \
+    imageprobe.h \
+    imagepool.h \
+    renderplan.h \
+    batchstats.h \
+    rowstream.h \
+    headless.h \
+    fileutil.h
+SOURCES   += profile.cpp \
+    profileregistry.cpp \
+    jobqueue.cpp \
+    watermarkengine.cpp \
+    blend.cpp \
+    manifest.cpp \
+    jpegregion.cpp \
+    pngencoder.cpp \
+    memorybudget.cpp \
+    mappedfile.cpp \
+    imageprobe.cpp \
+    imagepool.cpp \
+    renderplan.cpp \
+    batchstats.cpp \
+    rowstream.cpp \
+    headless.cpp \
+    fileutil.cpp
+
+# JPEG watermarking in the DCT domain, CONFIG+=no_libjpeg to build without
+!no_libjpeg:DEFINES += HAVE_LIBJPEG
+
+# parallel PNG deflate, CONFIG+=no_zlib to use Qt's PNG writer only
+!no_zlib:DEFINES += HAVE_ZLIB
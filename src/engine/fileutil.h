@@ -0,0 +1,13 @@
+#ifndef FILEUTIL_H
+#define FILEUTIL_H
+
+#include <QString>
+
+
+/* Renames from over an existing file to in one step, unlike
+ * QFile::rename(), so to always exists, old or new. Both must be on the
+ * same file system.
+ */
+bool replaceFile(const QString &from, const QString &to);
+
+#endif // FILEUTIL_H
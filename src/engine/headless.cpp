@@ -0,0 +1,23 @@
+#include "headless.h"
+
+
+#if QT_VERSION >= 0x050000
+HeadlessApplication::HeadlessApplication(int &argc, char **argv)
+    : QGuiApplication(selectPlatform(argc), argv)
+{
+}
+#else
+HeadlessApplication::HeadlessApplication(int &argc, char **argv)
+    : QApplication(selectPlatform(argc), argv, false)
+{
+}
+#endif
+
+int &HeadlessApplication::selectPlatform(int &argc)
+{
+#if QT_VERSION >= 0x050000
+    if (qgetenv("QT_QPA_PLATFORM").isEmpty())
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+#endif
+    return argc;
+}
@@ -0,0 +1,33 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <QtGlobal>
+#if QT_VERSION >= 0x050000
+#include <QGuiApplication>
+#else
+#include <QApplication>
+#endif
+
+
+/*! The application object of the command line tool, the bench and the
+ * tests.
+ *
+ * Text watermarks need the font system, but never a display or widgets:
+ * Qt 5 runs on the offscreen platform unless QT_QPA_PLATFORM names
+ * another one, Qt 4 without a connection to the window system.
+ */
+#if QT_VERSION >= 0x050000
+class HeadlessApplication : public QGuiApplication
+#else
+class HeadlessApplication : public QApplication
+#endif
+{
+public:
+    HeadlessApplication(int &argc, char **argv);
+
+private:
+    // sets up the environment before the base class reads it
+    static int &selectPlatform(int &argc);
+};
+
+#endif // HEADLESS_H
@@ -0,0 +1,190 @@
+#include <QMutexLocker>
+
+#include "imagepool.h"
+
+#include <limits.h>
+
+
+static const int s_pageSize = 4096;
+
+// quarter steps between powers of two waste at most a fifth
+static qint64 sizeClass(qint64 bytes)
+{
+    qint64 p = s_pageSize;
+    while (p * 2 <= bytes)
+        p *= 2;
+    for (int q = 0; q < 4; ++q)
+    {
+        if (p + p / 4 * q >= bytes)
+            return p + p / 4 * q;
+    }
+    return p * 2;
+}
+
+#if QT_VERSION >= 0x050000
+// 0 for formats left to QImage
+static int formatDepth(QImage::Format format)
+{
+    switch (format)
+    {
+    case QImage::Format_Mono:
+    case QImage::Format_MonoLSB:
+        return 1;
+    case QImage::Format_Indexed8:
+#if QT_VERSION >= 0x050500
+    case QImage::Format_Grayscale8:
+#endif
+        return 8;
+    case QImage::Format_RGB16:
+        return 16;
+    case QImage::Format_RGB888:
+        return 24;
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+        return 32;
+    default:
+        return 0;
+    }
+}
+#endif
+
+
+ImagePool::Shared::~Shared()
+{
+    foreach (Buffer *b, free)
+        freeBuffer(b);
+}
+
+ImagePool::ImagePool(qint64 maxCached)
+    : d(new Shared)
+{
+    d->maxCached = maxCached;
+}
+
+ImagePool::~ImagePool()
+{
+    // images still around return their buffers straight to the heap
+    setMaxCached(0);
+}
+
+qint64 ImagePool::maxCached() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->maxCached;
+}
+
+void ImagePool::setMaxCached(qint64 bytes)
+{
+    QList<Buffer *> trimmed;
+    {
+        QMutexLocker locker(&d->mutex);
+        d->maxCached = qMax(qint64(0), bytes);
+        while (d->cached > d->maxCached && !d->free.isEmpty())
+        {
+            trimmed << d->free.takeFirst();
+            d->cached -= trimmed.last()->size;
+        }
+    }
+
+    foreach (Buffer *b, trimmed)
+        freeBuffer(b);
+}
+
+qint64 ImagePool::cached() const
+{
+    QMutexLocker locker(&d->mutex);
+    return d->cached;
+}
+
+void ImagePool::clear()
+{
+    QList<Buffer *> trimmed;
+    {
+        QMutexLocker locker(&d->mutex);
+        trimmed = d->free;
+        d->free.clear();
+        d->cached = 0;
+    }
+
+    foreach (Buffer *b, trimmed)
+        freeBuffer(b);
+}
+
+QImage ImagePool::image(const QSize &size, QImage::Format format)
+{
+#if QT_VERSION >= 0x050000
+    const int depth = formatDepth(format);
+    if (depth == 0 || size.isEmpty())
+        return QImage(size, format);
+
+    // QImage's own scan line alignment
+    const qint64 bpl = ((qint64(size.width()) * depth + 31) >> 5) << 2;
+    if (bpl * size.height() > INT_MAX)
+        return QImage(size, format);
+
+    Buffer *b = take(sizeClass(bpl * size.height()));
+    if (!b)
+        return QImage(size, format);
+    return QImage(b->data, size.width(), size.height(), int(bpl), format, &ImagePool::returnBuffer, b);
+#else
+    return QImage(size, format);
+#endif
+}
+
+ImagePool::Buffer *ImagePool::take(qint64 size)
+{
+    {
+        QMutexLocker locker(&d->mutex);
+        // the most recently used is the most likely to still be cached by the CPU
+        for (int i = d->free.size() - 1; i >= 0; --i)
+        {
+            if (d->free.at(i)->size == size)
+            {
+                Buffer *b = d->free.takeAt(i);
+                d->cached -= size;
+                b->pool = d;
+                return b;
+            }
+        }
+    }
+
+    uchar *data = static_cast<uchar *>(qMallocAligned(size, s_pageSize));
+    if (!data)
+        return 0;
+
+    Buffer *b = new Buffer;
+    b->data = data;
+    b->size = size;
+    b->pool = d;
+    return b;
+}
+
+void ImagePool::freeBuffer(Buffer *buffer)
+{
+    qFreeAligned(buffer->data);
+    delete buffer;
+}
+
+void ImagePool::returnBuffer(void *info)
+{
+    Buffer *b = static_cast<Buffer *>(info);
+    QSharedPointer<Shared> pool = b->pool;
+    // the free list must not keep its own pool alive
+    b->pool.clear();
+
+    QList<Buffer *> trimmed;
+    {
+        QMutexLocker locker(&pool->mutex);
+        pool->free << b;
+        pool->cached += b->size;
+        while (pool->cached > pool->maxCached && !pool->free.isEmpty())
+        {
+            trimmed << pool->free.takeFirst();
+            pool->cached -= trimmed.last()->size;
+        }
+    }
+
+    foreach (Buffer *t, trimmed)
+        freeBuffer(t);
+}
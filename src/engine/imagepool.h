@@ -0,0 +1,66 @@
+#ifndef IMAGEPOOL_H
+#define IMAGEPOOL_H
+
+#include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QSharedPointer>
+
+
+/*! Pixel buffers for decoded images, reused from one image to the next.
+ *
+ * image() hands out a QImage over a buffer from the pool. When the last
+ * copy of that image goes away the buffer returns to the pool instead
+ * of the heap, so the next image of a similar size gets memory that is
+ * already mapped: no allocation, no page faults on first touch and no
+ * heap fragmented by large blocks freed in random order. Buffers are
+ * page aligned and come in size classes a quarter of a power of two
+ * apart.
+ *
+ * Images handed out may outlive the pool. Needs Qt 5, Qt 4 has no
+ * QImage cleanup function and gets plain images. Thread safe.
+ */
+class ImagePool
+{
+public:
+    ImagePool(qint64 maxCached = 0);
+    ~ImagePool();
+
+    // bytes of unused buffers kept, the oldest ones are freed beyond it
+    qint64 maxCached() const;
+    void setMaxCached(qint64 bytes);
+    qint64 cached() const;
+
+    // uninitialized pixels, as from the QImage(QSize, Format) constructor
+    QImage image(const QSize &size, QImage::Format format);
+    // frees the unused buffers
+    void clear();
+
+private:
+    struct Buffer;
+    struct Shared {
+        Shared() : maxCached(0), cached(0) {}
+        ~Shared();
+        QMutex mutex;
+        qint64 maxCached;
+        qint64 cached;
+        // unused, in the order they came back
+        QList<Buffer *> free;
+    };
+    struct Buffer {
+        uchar *data;
+        qint64 size;
+        // set while in use, so the pool lives as long as its images
+        QSharedPointer<Shared> pool;
+    };
+
+    QSharedPointer<Shared> d;
+
+    Buffer *take(qint64 size);
+    static void freeBuffer(Buffer *buffer);
+    static void returnBuffer(void *info);
+
+    Q_DISABLE_COPY(ImagePool)
+};
+
+#endif // IMAGEPOOL_H
@@ -0,0 +1,225 @@
+#include <QtDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+
+#include "imageprobe.h"
+
+#include <limits.h>
+
+
+static const int s_maxIfdEntries = 1024;
+
+static quint16 get16(const uchar *p, bool littleEndian)
+{
+    return littleEndian ? quint16(p[0] | p[1] << 8) : quint16(p[0] << 8 | p[1]);
+}
+
+static quint32 get32(const uchar *p, bool littleEndian)
+{
+    return littleEndian ? quint32(p[0] | p[1] << 8 | p[2] << 16) | quint32(p[3]) << 24
+                        : quint32(p[0]) << 24 | quint32(p[1] << 16 | p[2] << 8 | p[3]);
+}
+
+static bool readFully(QIODevice *device, void *data, int size)
+{
+    return device->read(static_cast<char *>(data), size) == size;
+}
+
+/* Reads the first IFD of the TIFF structure starting at base: a TIFF
+ * file or the EXIF block of a JPEG. The size is only taken when asked
+ * for, an EXIF block may describe its thumbnail there.
+ */
+static bool readTiff(QIODevice *device, qint64 base, bool withSize, ImageProbe::Info *info)
+{
+    uchar header[8];
+    if (!device->seek(base) || !readFully(device, header, sizeof(header)))
+        return false;
+
+    bool le;
+    if (header[0] == 'I' && header[1] == 'I')
+        le = true;
+    else if (header[0] == 'M' && header[1] == 'M')
+        le = false;
+    else
+        return false;
+    if (get16(header + 2, le) != 42)
+        return false;
+
+    uchar count[2];
+    if (!device->seek(base + get32(header + 4, le)) || !readFully(device, count, sizeof(count)))
+        return false;
+
+    int entries = qMin(int(get16(count, le)), s_maxIfdEntries);
+    QByteArray ifd = device->read(entries * 12);
+    entries = ifd.size() / 12;
+
+    quint32 width = 0;
+    quint32 height = 0;
+    for (int i = 0; i < entries; ++i)
+    {
+        const uchar *e = reinterpret_cast<const uchar *>(ifd.constData()) + i * 12;
+        const quint16 tag = get16(e, le);
+        const quint16 type = get16(e + 2, le);
+        // SHORT or LONG, values this small always sit in the entry itself
+        quint32 value;
+        if (type == 3)
+            value = get16(e + 8, le);
+        else if (type == 4)
+            value = get32(e + 8, le);
+        else
+            continue;
+
+        switch (tag)
+        {
+        case 0x0100:
+            width = value;
+            break;
+        case 0x0101:
+            height = value;
+            break;
+        case 0x0112:
+            if (value >= 1 && value <= 8)
+                info->orientation = value;
+            break;
+        }
+    }
+
+    if (withSize && width > 0 && height > 0 && width <= INT_MAX && height <= INT_MAX)
+        info->size = QSize(width, height);
+    return true;
+}
+
+// walks the markers up to the first frame header
+static bool probeJpeg(QIODevice *device, ImageProbe::Info *info)
+{
+    uchar soi[2];
+    if (!readFully(device, soi, sizeof(soi)) || soi[0] != 0xFF || soi[1] != 0xD8)
+        return false;
+
+    for (;;)
+    {
+        uchar c;
+        if (!readFully(device, &c, 1) || c != 0xFF)
+            return false;
+        // any number of fill bytes may precede a marker
+        while (c == 0xFF)
+        {
+            if (!readFully(device, &c, 1))
+                return false;
+        }
+
+        const uchar marker = c;
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+            continue;
+        // scan data or the end before any frame
+        if (marker == 0xD9 || marker == 0xDA)
+            return false;
+
+        uchar length[2];
+        if (!readFully(device, length, sizeof(length)) || get16(length, false) < 2)
+            return false;
+        const qint64 end = device->pos() + get16(length, false) - 2;
+
+        // SOF0..SOF15, except DHT, JPG and DAC which share the range
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+        {
+            uchar sof[5];
+            if (!readFully(device, sof, sizeof(sof)))
+                return false;
+            int height = get16(sof + 1, false);
+            int width = get16(sof + 3, false);
+            // a height of 0 is only given later by a DNL marker
+            if (width == 0 || height == 0)
+                return false;
+            info->size = QSize(width, height);
+            info->format = "jpeg";
+            return true;
+        }
+
+        if (marker == 0xE1 && end - device->pos() > 14)
+        {
+            char exif[6];
+            if (readFully(device, exif, sizeof(exif)) && qstrncmp(exif, "Exif", 5) == 0 && exif[5] == 0)
+                readTiff(device, device->pos(), false, info);
+        }
+
+        if (!device->seek(end))
+            return false;
+    }
+}
+
+static bool probePng(QIODevice *device, ImageProbe::Info *info)
+{
+    uchar header[24];
+    if (!readFully(device, header, sizeof(header)))
+        return false;
+    if (qstrncmp(reinterpret_cast<const char *>(header + 12), "IHDR", 4) != 0)
+        return false;
+
+    quint32 width = get32(header + 16, false);
+    quint32 height = get32(header + 20, false);
+    if (width == 0 || height == 0 || width > INT_MAX || height > INT_MAX)
+        return false;
+
+    info->size = QSize(width, height);
+    info->format = "png";
+    return true;
+}
+
+
+QSize ImageProbe::Info::orientedSize() const
+{
+    // 5..8 turn the image by 90 degrees
+    return orientation >= 5 ? size.transposed() : size;
+}
+
+qint64 ImageProbe::Info::decodedBytes() const
+{
+    return isValid() ? qint64(size.width()) * size.height() * 4 : 0;
+}
+
+ImageProbe::Info ImageProbe::probe(const QString &fileName)
+{
+    QFile f(fileName);
+    if (!f.open(QIODevice::ReadOnly))
+        return Info();
+    return probe(&f, QFileInfo(fileName).suffix().toLower().toLatin1());
+}
+
+ImageProbe::Info ImageProbe::probe(QIODevice *device, const QByteArray &formatHint)
+{
+    Info info;
+    const qint64 start = device->pos();
+    const QByteArray magic = device->peek(4);
+
+    if (magic.startsWith("\xFF\xD8\xFF"))
+    {
+        if (probeJpeg(device, &info))
+            return info;
+    }
+    else if (magic.startsWith("\x89PNG"))
+    {
+        if (probePng(device, &info))
+            return info;
+    }
+    else if (magic == QByteArray("II*\0", 4) || magic == QByteArray("MM\0*", 4))
+    {
+        if (readTiff(device, start, true, &info) && info.isValid())
+        {
+            info.format = "tiff";
+            return info;
+        }
+    }
+
+    // anything else, or a header the parsers above do not understand
+    info = Info();
+    if (!device->seek(start))
+        return info;
+    QImageReader reader(device, formatHint);
+    info.size = reader.size();
+    info.format = reader.format();
+    if (!info.isValid())
+        qDebug() << "Cannot probe the image size" << reader.errorString();
+    return info;
+}
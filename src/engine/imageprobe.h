@@ -0,0 +1,43 @@
+#ifndef IMAGEPROBE_H
+#define IMAGEPROBE_H
+
+#include <QByteArray>
+#include <QSize>
+#include <QString>
+
+class QIODevice;
+
+
+/*! Image dimensions read from the file header, without decoding.
+ *
+ * JPEG, PNG and TIFF headers are parsed here: only the markers before
+ * the first frame of a JPEG and the first IFD of a TIFF are read, so a
+ * probe costs a few small reads whatever the image size. The EXIF
+ * orientation comes from the same IFD parser. Other formats ask
+ * QImageReader::size(), which reads no more than the header for all
+ * of Qt's own plugins.
+ */
+class ImageProbe
+{
+public:
+
+    struct Info {
+        Info() : orientation(1) {}
+        // as stored, the orientation is not applied
+        QSize size;
+        QByteArray format;
+        // EXIF orientation 1..8, 1 when there is none
+        int orientation;
+
+        bool isValid() const { return size.isValid(); }
+        // the size a viewer honouring the orientation shows
+        QSize orientedSize() const;
+        // bytes of the image decoded to 32 bits per pixel
+        qint64 decodedBytes() const;
+    };
+
+    static Info probe(const QString &fileName);
+    static Info probe(QIODevice *device, const QByteArray &formatHint = QByteArray());
+};
+
+#endif // IMAGEPROBE_H
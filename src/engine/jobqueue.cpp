@@ -0,0 +1,224 @@
+#include <QtDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QSettings>
+#include <QStringList>
+#include <QTextStream>
+#if QT_VERSION >= 0x050000
+#include <QStandardPaths>
+#else
+#include <QDesktopServices>
+#endif
+
+#include "jobqueue.h"
+#include "profile.h"
+
+
+BatchJob::BatchJob()
+    : state(Queued),
+      position(WatermarkEngine::UpperLeft),
+      recursive(false),
+      incremental(false),
+      jpegRegion(true),
+      quality(-1),
+      pngCompression(-1),
+      stripMetadata(false)
+{
+}
+
+bool BatchJob::apply(WatermarkEngine *engine, QString *errorString) const
+{
+    if (!Profile::getProfiles().contains(profile))
+    {
+        *errorString = QObject::tr("Unknown profile: %1").arg(profile);
+        return false;
+    }
+
+    Profile p = Profile::getProfile(profile);
+    if (!p.isValid())
+    {
+        *errorString = QObject::tr("Profile is not valid: %1").arg(profile);
+        return false;
+    }
+
+    // batch overrides, never saved into the profile
+    if (!format.isEmpty())
+        p.setOutputFormat(Profile::formatFromName(format));
+    if (quality >= 0)
+        p.setQuality(quality);
+    if (pngCompression >= 0)
+        p.setPngCompression(pngCompression);
+    if (stripMetadata)
+        p.setMetadataPolicy(Profile::StripMetadata);
+
+    engine->setProfile(p);
+    engine->setPosition(position);
+    engine->setSourcePath(sourcePath);
+    engine->setDestinationPath(destinationPath);
+    engine->setRecursive(recursive);
+    engine->setIncremental(incremental);
+    engine->setJpegRegion(jpegRegion);
+    return true;
+}
+
+
+JobQueue::JobQueue(const QString &dir)
+    : m_dir(dir)
+{
+}
+
+JobQueue::~JobQueue()
+{
+    end();
+}
+
+QString JobQueue::defaultDir()
+{
+#if QT_VERSION >= 0x050000
+    return QStandardPaths::writableLocation(QStandardPaths::DataLocation) + "/jobs";
+#else
+    return QDesktopServices::storageLocation(QDesktopServices::DataLocation) + "/jobs";
+#endif
+}
+
+QString JobQueue::specPath(const QString &id) const
+{
+    return m_dir + '/' + id + ".job";
+}
+
+QString JobQueue::journalPath(const QString &id) const
+{
+    return m_dir + '/' + id + ".done";
+}
+
+QList<BatchJob> JobQueue::jobs() const
+{
+    QList<BatchJob> l;
+
+    // the ids sort by creation time
+    QStringList files = QDir(m_dir).entryList(QStringList() << "*.job", QDir::Files, QDir::Name);
+    foreach (const QString &f, files)
+    {
+        QSettings s(m_dir + '/' + f, QSettings::IniFormat);
+
+        BatchJob job;
+        job.id = QFileInfo(f).completeBaseName();
+        job.name = s.value("name").toString();
+        job.created = s.value("created").toDateTime();
+        job.state = BatchJob::State(s.value("state", BatchJob::Queued).toInt());
+        if (job.state == BatchJob::Running)
+            job.state = BatchJob::Interrupted;
+
+        job.sourcePath = s.value("sourcePath").toString();
+        job.destinationPath = s.value("destinationPath").toString();
+        job.profile = s.value("profile").toString();
+        job.position = WatermarkEngine::positionFromName(s.value("position").toString());
+        job.recursive = s.value("recursive", false).toBool();
+        job.incremental = s.value("incremental", false).toBool();
+        job.jpegRegion = s.value("jpegRegion", true).toBool();
+
+        job.format = s.value("format").toString();
+        job.quality = s.value("quality", -1).toInt();
+        job.pngCompression = s.value("pngCompression", -1).toInt();
+        job.stripMetadata = s.value("stripMetadata", false).toBool();
+
+        if (s.status() != QSettings::NoError || job.sourcePath.isEmpty())
+        {
+            qDebug() << "Ignoring broken job" << f;
+            continue;
+        }
+        l << job;
+    }
+
+    return l;
+}
+
+bool JobQueue::add(BatchJob *job)
+{
+    if (!QDir().mkpath(m_dir))
+        return false;
+
+    job->created = QDateTime::currentDateTime();
+    QString base = job->created.toString("yyyyMMdd-hhmmss-zzz");
+    job->id = base;
+    for (int i = 1; QFileInfo(specPath(job->id)).exists(); ++i)
+        job->id = QString("%1-%2").arg(base).arg(i);
+    if (job->name.isEmpty())
+        job->name = job->id;
+
+    return save(*job);
+}
+
+bool JobQueue::save(const BatchJob &job)
+{
+    QSettings s(specPath(job.id), QSettings::IniFormat);
+
+    s.setValue("name", job.name);
+    s.setValue("created", job.created);
+    s.setValue("state", int(job.state));
+
+    s.setValue("sourcePath", job.sourcePath);
+    s.setValue("destinationPath", job.destinationPath);
+    s.setValue("profile", job.profile);
+    s.setValue("position", WatermarkEngine::positionName(job.position));
+    s.setValue("recursive", job.recursive);
+    s.setValue("incremental", job.incremental);
+    s.setValue("jpegRegion", job.jpegRegion);
+
+    s.setValue("format", job.format);
+    s.setValue("quality", job.quality);
+    s.setValue("pngCompression", job.pngCompression);
+    s.setValue("stripMetadata", job.stripMetadata);
+
+    s.sync();
+    return s.status() == QSettings::NoError;
+}
+
+void JobQueue::finish(const BatchJob &job)
+{
+    QFile::remove(journalPath(job.id));
+    QFile::remove(specPath(job.id));
+}
+
+QSet<QString> JobQueue::completed(const BatchJob &job) const
+{
+    QSet<QString> done;
+
+    QFile f(journalPath(job.id));
+    if (!f.open(QIODevice::ReadOnly | QIODevice::Text))
+        return done;
+
+    QTextStream s(&f);
+    s.setCodec("UTF-8");
+    while (!s.atEnd())
+    {
+        // a crash may cut the last line, it just is not found then
+        QString line = s.readLine();
+        if (!line.isEmpty())
+            done.insert(line);
+    }
+    return done;
+}
+
+bool JobQueue::begin(const BatchJob &job)
+{
+    end();
+    m_journal.setFileName(journalPath(job.id));
+    return m_journal.open(QIODevice::WriteOnly | QIODevice::Append);
+}
+
+void JobQueue::markCompleted(const QString &source)
+{
+    if (!m_journal.isOpen())
+        return;
+
+    m_journal.write(source.toUtf8() + '\n');
+    // to the OS right away, so a crash of the application keeps it
+    m_journal.flush();
+}
+
+void JobQueue::end()
+{
+    if (m_journal.isOpen())
+        m_journal.close();
+}
@@ -0,0 +1,95 @@
+#ifndef JOBQUEUE_H
+#define JOBQUEUE_H
+
+#include <QDateTime>
+#include <QFile>
+#include <QList>
+#include <QSet>
+#include <QString>
+
+#include "watermarkengine.h"
+
+
+/*! Everything needed to run a batch again: folders, profile, position
+ * and the per-batch overrides of the profile's output settings.
+ */
+struct BatchJob
+{
+    enum State {
+        Queued,
+        // still Running when read back means the process died
+        Running,
+        Interrupted
+    };
+
+    BatchJob();
+
+    QString id;
+    QString name;
+    QDateTime created;
+    State state;
+
+    QString sourcePath;
+    QString destinationPath;
+    QString profile;
+    WatermarkEngine::Position position;
+    bool recursive;
+    bool incremental;
+    bool jpegRegion;
+
+    // empty or negative for the profile's own setting
+    QString format;
+    int quality;
+    int pngCompression;
+    bool stripMetadata;
+
+    /* Sets up the engine for this job, except the thread and memory
+     * tuning which belongs to the machine, not the job.
+     */
+    bool apply(WatermarkEngine *engine, QString *errorString) const;
+};
+
+
+/*! Batch jobs kept on disk until they finish.
+ *
+ * Every job is an ini file in the queue directory, plus a journal of
+ * the sources already written, one per line, appended and flushed as
+ * the engine reports them. A job interrupted by a cancel or a crash
+ * is resumed by passing the journal to
+ * WatermarkEngine::setCompletedFiles(). Finished jobs are removed.
+ */
+class JobQueue
+{
+public:
+    JobQueue(const QString &dir = defaultDir());
+    ~JobQueue();
+
+    static QString defaultDir();
+
+    // unfinished jobs, oldest first
+    QList<BatchJob> jobs() const;
+
+    // assigns the id and writes the job
+    bool add(BatchJob *job);
+    bool save(const BatchJob &job);
+    // removes the job and its journal
+    void finish(const BatchJob &job);
+
+    QSet<QString> completed(const BatchJob &job) const;
+
+    // journal of the running job
+    bool begin(const BatchJob &job);
+    void markCompleted(const QString &source);
+    void end();
+
+private:
+    QString m_dir;
+    QFile m_journal;
+
+    QString specPath(const QString &id) const;
+    QString journalPath(const QString &id) const;
+
+    Q_DISABLE_COPY(JobQueue)
+};
+
+#endif // JOBQUEUE_H
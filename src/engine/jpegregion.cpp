@@ -0,0 +1,644 @@
+#include <QPainter>
+#include <QVector>
+
+#include "jpegregion.h"
+#include "blend.h"
+
+#ifdef HAVE_LIBJPEG
+
+#include <qmath.h>
+
+#include "jpegsupport.h"
+
+
+// source manager over the complete file in memory
+static void initSource(j_decompress_ptr)
+{
+}
+
+static boolean fillInputBuffer(j_decompress_ptr cinfo)
+{
+    // truncated file, pretend it ends properly as libjpeg's own managers do
+    static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+    cinfo->src->next_input_byte = eoi;
+    cinfo->src->bytes_in_buffer = 2;
+    return TRUE;
+}
+
+static void skipInputData(j_decompress_ptr cinfo, long n)
+{
+    if (n <= 0)
+        return;
+    if (size_t(n) > cinfo->src->bytes_in_buffer)
+    {
+        fillInputBuffer(cinfo);
+        return;
+    }
+    cinfo->src->next_input_byte += n;
+    cinfo->src->bytes_in_buffer -= n;
+}
+
+static void termSource(j_decompress_ptr)
+{
+}
+
+// destination manager appending to a QByteArray
+struct JpegDestination
+{
+    jpeg_destination_mgr pub;
+    QByteArray *out;
+    JOCTET buffer[64 * 1024];
+};
+
+static void initDestination(j_compress_ptr cinfo)
+{
+    JpegDestination *dest = reinterpret_cast<JpegDestination *>(cinfo->dest);
+    dest->pub.next_output_byte = dest->buffer;
+    dest->pub.free_in_buffer = sizeof(dest->buffer);
+}
+
+static boolean emptyOutputBuffer(j_compress_ptr cinfo)
+{
+    JpegDestination *dest = reinterpret_cast<JpegDestination *>(cinfo->dest);
+    dest->out->append(reinterpret_cast<const char *>(dest->buffer), sizeof(dest->buffer));
+    dest->pub.next_output_byte = dest->buffer;
+    dest->pub.free_in_buffer = sizeof(dest->buffer);
+    return TRUE;
+}
+
+static void termDestination(j_compress_ptr cinfo)
+{
+    JpegDestination *dest = reinterpret_cast<JpegDestination *>(cinfo->dest);
+    dest->out->append(reinterpret_cast<const char *>(dest->buffer), sizeof(dest->buffer) - dest->pub.free_in_buffer);
+}
+
+
+struct JpegRegionEditorPrivate
+{
+    JpegRegionEditorPrivate()
+        : decompressCreated(false),
+          compressCreated(false),
+          headerRead(false),
+          coefficients(0),
+          touched(false),
+          progressive(-1),
+          optimized(true),
+          keepMetadata(true)
+    {
+        std::memset(&src, 0, sizeof(src));
+        std::memset(&dst, 0, sizeof(dst));
+        jpegInitErrorManager(&err);
+        src.err = &err.pub;
+        dst.err = &err.pub;
+    }
+
+    ~JpegRegionEditorPrivate()
+    {
+        if (compressCreated)
+            jpeg_destroy_compress(&dst);
+        if (decompressCreated)
+            jpeg_destroy_decompress(&src);
+    }
+
+    JpegErrorManager err;
+    jpeg_decompress_struct src;
+    jpeg_source_mgr srcManager;
+    jpeg_compress_struct dst;
+    JpegDestination dest;
+    bool decompressCreated;
+    bool compressCreated;
+    bool headerRead;
+    jvirt_barray_ptr *coefficients;
+    bool touched;
+
+    int progressive; // -1 as the source
+    bool optimized;
+    bool keepMetadata;
+
+    QByteArray data;
+    QString error;
+};
+
+static bool readHeader(JpegRegionEditorPrivate *d)
+{
+    if (setjmp(d->err.jump))
+        return false;
+
+    jpeg_create_decompress(&d->src);
+    d->decompressCreated = true;
+
+    d->srcManager.init_source = initSource;
+    d->srcManager.fill_input_buffer = fillInputBuffer;
+    d->srcManager.skip_input_data = skipInputData;
+    d->srcManager.resync_to_restart = jpeg_resync_to_restart;
+    d->srcManager.term_source = termSource;
+    d->srcManager.next_input_byte = reinterpret_cast<const JOCTET *>(d->data.constData());
+    d->srcManager.bytes_in_buffer = d->data.size();
+    d->src.src = &d->srcManager;
+
+    jpegSaveMarkers(&d->src);
+
+    jpeg_read_header(&d->src, TRUE);
+
+    bool supported = d->src.data_precision == 8
+            && ((d->src.num_components == 1 && d->src.jpeg_color_space == JCS_GRAYSCALE)
+                || (d->src.num_components == 3 && d->src.jpeg_color_space == JCS_YCbCr));
+    if (!supported)
+    {
+        std::strcpy(d->err.message, "unsupported JPEG color space or precision");
+        return false;
+    }
+    return true;
+}
+
+static bool readCoefficients(JpegRegionEditorPrivate *d)
+{
+    if (setjmp(d->err.jump))
+        return false;
+
+    d->coefficients = jpeg_read_coefficients(&d->src);
+    return true;
+}
+
+// one block row; libjpeg limits how many rows may be accessed at once
+static JBLOCKROW accessBlockRow(JpegRegionEditorPrivate *d, int component, int row)
+{
+    if (setjmp(d->err.jump))
+        return 0;
+
+    JBLOCKARRAY rows = (*d->src.mem->access_virt_barray)(reinterpret_cast<j_common_ptr>(&d->src),
+                                                         d->coefficients[component], row, 1, TRUE);
+    return rows[0];
+}
+
+static bool writeCoefficients(JpegRegionEditorPrivate *d, QByteArray *out)
+{
+    if (setjmp(d->err.jump))
+        return false;
+
+    jpeg_create_compress(&d->dst);
+    d->compressCreated = true;
+
+    d->dest.pub.init_destination = initDestination;
+    d->dest.pub.empty_output_buffer = emptyOutputBuffer;
+    d->dest.pub.term_destination = termDestination;
+    d->dest.out = out;
+    d->dst.dest = &d->dest.pub;
+
+    jpeg_copy_critical_parameters(&d->src, &d->dst);
+    d->dst.optimize_coding = d->optimized ? TRUE : FALSE;
+    if (d->progressive < 0 ? d->src.progressive_mode : d->progressive)
+        jpeg_simple_progression(&d->dst);
+
+    jpeg_write_coefficients(&d->dst, d->coefficients);
+
+    jpegCopyMarkers(&d->src, &d->dst, d->keepMetadata);
+
+    jpeg_finish_compress(&d->dst);
+    return true;
+}
+
+
+/* Float DCT on one 8x8 block. JPEG's DCT is the orthonormal DCT-II,
+ * so the forward and inverse transforms share one basis table.
+ */
+static float s_basis[DCTSIZE][DCTSIZE]; // [frequency][sample]
+
+static bool initBasis()
+{
+    for (int u = 0; u < DCTSIZE; ++u)
+    {
+        double a = u == 0 ? qSqrt(1.0 / DCTSIZE) : qSqrt(2.0 / DCTSIZE);
+        for (int x = 0; x < DCTSIZE; ++x)
+            s_basis[u][x] = float(a * qCos((2 * x + 1) * u * M_PI / (2 * DCTSIZE)));
+    }
+    return true;
+}
+
+static const bool s_basisReady = initBasis();
+
+static void inverseDct(const JCOEF *coef, const UINT16 *quant, float *out, int stride)
+{
+    float f[DCTSIZE2];
+    for (int k = 0; k < DCTSIZE2; ++k)
+        f[k] = float(coef[k]) * quant[k];
+
+    // columns, then rows
+    float tmp[DCTSIZE2];
+    for (int u = 0; u < DCTSIZE; ++u)
+        for (int y = 0; y < DCTSIZE; ++y)
+        {
+            float s = 0;
+            for (int v = 0; v < DCTSIZE; ++v)
+                s += s_basis[v][y] * f[v * DCTSIZE + u];
+            tmp[y * DCTSIZE + u] = s;
+        }
+
+    for (int y = 0; y < DCTSIZE; ++y)
+        for (int x = 0; x < DCTSIZE; ++x)
+        {
+            float s = 0;
+            for (int u = 0; u < DCTSIZE; ++u)
+                s += s_basis[u][x] * tmp[y * DCTSIZE + u];
+            out[y * stride + x] = s + CENTERJSAMPLE;
+        }
+}
+
+static void forwardDct(const float *in, int stride, const UINT16 *quant, JCOEF *coef)
+{
+    float tmp[DCTSIZE2];
+    for (int y = 0; y < DCTSIZE; ++y)
+        for (int u = 0; u < DCTSIZE; ++u)
+        {
+            float s = 0;
+            for (int x = 0; x < DCTSIZE; ++x)
+                s += s_basis[u][x] * (in[y * stride + x] - CENTERJSAMPLE);
+            tmp[y * DCTSIZE + u] = s;
+        }
+
+    for (int v = 0; v < DCTSIZE; ++v)
+        for (int u = 0; u < DCTSIZE; ++u)
+        {
+            float s = 0;
+            for (int y = 0; y < DCTSIZE; ++y)
+                s += s_basis[v][y] * tmp[y * DCTSIZE + u];
+            int k = v * DCTSIZE + u;
+            int limit = k == 0 ? 2047 : 1023;
+            coef[k] = JCOEF(qBound(-limit, qRound(s / quant[k]), limit));
+        }
+}
+
+
+/* Samples of one component around the edited region, as floats so the
+ * untouched samples of a re-encoded block go back exactly as they came.
+ */
+struct Plane
+{
+    int hs, vs;         // sampling factors relative to the largest ones
+    int bx0, by0;       // first block
+    int bw, bh;         // blocks
+    int stride;
+    QVector<float> samples;
+    QVector<bool> dirty;
+
+    float *block(int bx, int by) { return samples.data() + by * DCTSIZE * stride + bx * DCTSIZE; }
+    float &at(int sx, int sy) { return samples[(sy - by0 * DCTSIZE) * stride + sx - bx0 * DCTSIZE]; }
+};
+
+static inline int ceilDiv(int a, int b)
+{
+    return (a + b - 1) / b;
+}
+
+static inline uint toRgb(float y, float cb, float cr)
+{
+    int r = qBound(0, qRound(y + 1.402f * (cr - 128)), 255);
+    int g = qBound(0, qRound(y - 0.344136f * (cb - 128) - 0.714136f * (cr - 128)), 255);
+    int b = qBound(0, qRound(y + 1.772f * (cb - 128)), 255);
+    return 0xff000000 | (r << 16) | (g << 8) | b;
+}
+
+static inline void toYCbCr(uint rgb, float *ycc)
+{
+    float r = (rgb >> 16) & 0xff;
+    float g = (rgb >> 8) & 0xff;
+    float b = rgb & 0xff;
+    ycc[0] = 0.299f * r + 0.587f * g + 0.114f * b;
+    ycc[1] = -0.168736f * r - 0.331264f * g + 0.5f * b + 128;
+    ycc[2] = 0.5f * r - 0.418688f * g - 0.081312f * b + 128;
+}
+
+
+JpegRegionEditor::JpegRegionEditor()
+    : d(new JpegRegionEditorPrivate)
+{
+}
+
+JpegRegionEditor::~JpegRegionEditor()
+{
+    delete d;
+}
+
+bool JpegRegionEditor::isAvailable()
+{
+    return true;
+}
+
+bool JpegRegionEditor::readHeader(const QByteArray &data)
+{
+    Q_ASSERT(!d->decompressCreated);
+
+    d->data = data;
+    if (!::readHeader(d))
+    {
+        d->error = QString::fromLatin1(d->err.message);
+        return false;
+    }
+    d->headerRead = true;
+    return true;
+}
+
+bool JpegRegionEditor::readCoefficients()
+{
+    Q_ASSERT(d->headerRead && !d->coefficients);
+
+    if (!::readCoefficients(d))
+    {
+        d->error = QString::fromLatin1(d->err.message);
+        return false;
+    }
+    return true;
+}
+
+bool JpegRegionEditor::open(const QByteArray &data)
+{
+    return readHeader(data) && readCoefficients();
+}
+
+QSize JpegRegionEditor::size() const
+{
+    return QSize(d->src.image_width, d->src.image_height);
+}
+
+qint64 JpegRegionEditor::bufferedBytes() const
+{
+    return d->headerRead ? jpegCoefficientBytes(&d->src) : 0;
+}
+
+bool JpegRegionEditor::apply(const QImage &sprite, const QPoint &pos, qreal opacity)
+{
+    Q_ASSERT(d->coefficients);
+
+    const int w = d->src.image_width;
+    const int h = d->src.image_height;
+    const int maxH = d->src.max_h_samp_factor;
+    const int maxV = d->src.max_v_samp_factor;
+    const int nc = d->src.num_components;
+
+    QRect r = QRect(pos, sprite.size()) & QRect(0, 0, w, h);
+    if (r.isEmpty())
+        return true;
+
+    // widen to whole MCUs, so every touched sample is decoded with its neighbours
+    const int mcuW = maxH * DCTSIZE;
+    const int mcuH = maxV * DCTSIZE;
+    QRect region(QPoint(r.left() / mcuW * mcuW, r.top() / mcuH * mcuH),
+                 QPoint(qMin(w, ceilDiv(r.right() + 1, mcuW) * mcuW) - 1,
+                        qMin(h, ceilDiv(r.bottom() + 1, mcuH) * mcuH) - 1));
+
+    QVector<Plane> planes(nc);
+    for (int c = 0; c < nc; ++c)
+    {
+        jpeg_component_info *ci = d->src.comp_info + c;
+        Plane &p = planes[c];
+        p.hs = ci->h_samp_factor;
+        p.vs = ci->v_samp_factor;
+        p.bx0 = region.left() * p.hs / maxH / DCTSIZE;
+        p.by0 = region.top() * p.vs / maxV / DCTSIZE;
+        p.bw = qMin<int>(ceilDiv(ceilDiv((region.right() + 1) * p.hs, maxH), DCTSIZE), ci->width_in_blocks) - p.bx0;
+        p.bh = qMin<int>(ceilDiv(ceilDiv((region.bottom() + 1) * p.vs, maxV), DCTSIZE), ci->height_in_blocks) - p.by0;
+        p.stride = p.bw * DCTSIZE;
+        p.samples.resize(p.stride * p.bh * DCTSIZE);
+        p.dirty.fill(false, p.bw * p.bh);
+
+        for (int by = 0; by < p.bh; ++by)
+        {
+            JBLOCKROW row = accessBlockRow(d, c, p.by0 + by);
+            if (!row)
+            {
+                d->error = QString::fromLatin1(d->err.message);
+                return false;
+            }
+            for (int bx = 0; bx < p.bw; ++bx)
+                inverseDct(row[p.bx0 + bx], ci->quant_table->quantval, p.block(bx, by), p.stride);
+        }
+    }
+
+    // the region as RGB, composite the watermark there
+    QImage before(region.size(), QImage::Format_RGB32);
+    for (int y = region.top(); y <= region.bottom(); ++y)
+    {
+        QRgb *line = reinterpret_cast<QRgb *>(before.scanLine(y - region.top()));
+        for (int x = region.left(); x <= region.right(); ++x)
+        {
+            float luma = planes[0].at(x * planes[0].hs / maxH, y * planes[0].vs / maxV);
+            if (nc == 1)
+                line[x - region.left()] = toRgb(luma, 128, 128);
+            else
+                line[x - region.left()] = toRgb(luma,
+                                                planes[1].at(x * planes[1].hs / maxH, y * planes[1].vs / maxV),
+                                                planes[2].at(x * planes[2].hs / maxH, y * planes[2].vs / maxV));
+        }
+    }
+
+    QImage after = before.copy();
+    QPoint spritePos = pos - region.topLeft();
+    if (!blendSprite(&after, spritePos.x(), spritePos.y(), sprite, opacity))
+    {
+        QPainter painter(&after);
+        painter.setOpacity(opacity);
+        painter.drawImage(spritePos, sprite);
+    }
+
+    /* Back to samples. A sample covers a box of pixels (more than one for
+     * subsampled chroma); it is replaced by the box average only if some
+     * pixel of the box changed, untouched pixels contribute their
+     * original value.
+     */
+    QVector<QVector<float> > sums(nc);
+    QVector<QVector<int> > changed(nc);
+    for (int c = 0; c < nc; ++c)
+    {
+        sums[c].fill(0, planes[c].samples.size());
+        changed[c].fill(0, planes[c].samples.size());
+    }
+
+    for (int y = region.top(); y <= region.bottom(); ++y)
+    {
+        const QRgb *b = reinterpret_cast<const QRgb *>(before.constScanLine(y - region.top()));
+        const QRgb *a = reinterpret_cast<const QRgb *>(after.constScanLine(y - region.top()));
+        for (int x = region.left(); x <= region.right(); ++x)
+        {
+            QRgb rgb = a[x - region.left()];
+            if (rgb == b[x - region.left()])
+                continue;
+
+            float ycc[3];
+            toYCbCr(rgb, ycc);
+            if (nc == 1)
+                ycc[0] = qGray(rgb);
+
+            for (int c = 0; c < nc; ++c)
+            {
+                Plane &p = planes[c];
+                int i = &p.at(x * p.hs / maxH, y * p.vs / maxV) - p.samples.data();
+                sums[c][i] += ycc[c];
+                changed[c][i]++;
+            }
+        }
+    }
+
+    for (int c = 0; c < nc; ++c)
+    {
+        Plane &p = planes[c];
+        const int boxW = maxH / p.hs;
+        const int boxH = maxV / p.vs;
+        for (int i = 0; i < p.samples.size(); ++i)
+        {
+            if (!changed[c][i])
+                continue;
+
+            int sx = i % p.stride;
+            int sy = i / p.stride;
+            // pixels of the box inside the image and not changed keep their sample
+            int gx = (p.bx0 * DCTSIZE + sx) * boxW;
+            int gy = (p.by0 * DCTSIZE + sy) * boxH;
+            int inside = (qMin(gx + boxW, w) - gx) * (qMin(gy + boxH, h) - gy);
+            float v = (sums[c][i] + (inside - changed[c][i]) * p.samples[i]) / inside;
+
+            p.samples[i] = qBound(0.0f, v, 255.0f);
+            p.dirty[(sy / DCTSIZE) * p.bw + sx / DCTSIZE] = true;
+        }
+    }
+
+    for (int c = 0; c < nc; ++c)
+    {
+        Plane &p = planes[c];
+        const UINT16 *quant = d->src.comp_info[c].quant_table->quantval;
+        for (int by = 0; by < p.bh; ++by)
+        {
+            JBLOCKROW row = 0;
+            for (int bx = 0; bx < p.bw; ++bx)
+            {
+                if (!p.dirty[by * p.bw + bx])
+                    continue;
+                if (!row && !(row = accessBlockRow(d, c, p.by0 + by)))
+                {
+                    d->error = QString::fromLatin1(d->err.message);
+                    return false;
+                }
+                forwardDct(p.block(bx, by), p.stride, quant, row[p.bx0 + bx]);
+                d->touched = true;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool JpegRegionEditor::write(QByteArray *out)
+{
+    Q_ASSERT(d->coefficients && !d->compressCreated);
+
+    // keeps the capacity of a reused (reserved) buffer
+    out->resize(0);
+
+    // watermark outside of the frame, the original is as good as it gets
+    if (!d->touched && d->keepMetadata && d->progressive < 0)
+    {
+        out->append(d->data);
+        return true;
+    }
+
+    if (!writeCoefficients(d, out))
+    {
+        d->error = QString::fromLatin1(d->err.message);
+        return false;
+    }
+
+    return true;
+}
+
+void JpegRegionEditor::setProgressive(bool p)
+{
+    d->progressive = p;
+}
+
+void JpegRegionEditor::setOptimized(bool o)
+{
+    d->optimized = o;
+}
+
+void JpegRegionEditor::setKeepMetadata(bool k)
+{
+    d->keepMetadata = k;
+}
+
+QString JpegRegionEditor::errorString() const
+{
+    return d->error;
+}
+
+#else // HAVE_LIBJPEG
+
+struct JpegRegionEditorPrivate
+{
+};
+
+JpegRegionEditor::JpegRegionEditor()
+    : d(0)
+{
+}
+
+JpegRegionEditor::~JpegRegionEditor()
+{
+}
+
+bool JpegRegionEditor::isAvailable()
+{
+    return false;
+}
+
+bool JpegRegionEditor::readHeader(const QByteArray &)
+{
+    return false;
+}
+
+bool JpegRegionEditor::readCoefficients()
+{
+    return false;
+}
+
+bool JpegRegionEditor::open(const QByteArray &)
+{
+    return false;
+}
+
+QSize JpegRegionEditor::size() const
+{
+    return QSize();
+}
+
+qint64 JpegRegionEditor::bufferedBytes() const
+{
+    return 0;
+}
+
+bool JpegRegionEditor::apply(const QImage &, const QPoint &, qreal)
+{
+    return false;
+}
+
+bool JpegRegionEditor::write(QByteArray *)
+{
+    return false;
+}
+
+void JpegRegionEditor::setProgressive(bool)
+{
+}
+
+void JpegRegionEditor::setOptimized(bool)
+{
+}
+
+void JpegRegionEditor::setKeepMetadata(bool)
+{
+}
+
+QString JpegRegionEditor::errorString() const
+{
+    return QString::fromLatin1("built without libjpeg");
+}
+
+#endif // HAVE_LIBJPEG
@@ -0,0 +1,64 @@
+#ifndef JPEGREGION_H
+#define JPEGREGION_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QString>
+
+struct JpegRegionEditorPrivate;
+
+
+/*! Watermarks a JPEG in the DCT domain.
+ *
+ * open() entropy decodes the file into quantized coefficients without
+ * running the IDCT. apply() then decodes only the 8x8 blocks under the
+ * watermark, composites the sprite there and quantizes the touched
+ * blocks again with the file's own tables. write() entropy codes the
+ * result. All other blocks are copied through untouched, so the image
+ * decodes identically outside the watermark and there is no generation
+ * loss in the rest of the frame. The file bytes still differ, the
+ * Huffman tables are optimized for the new content.
+ *
+ * Baseline and progressive 8 bit grayscale or YCbCr files are supported.
+ * Anything else (CMYK, 12 bit, ...) makes open() fail and the caller
+ * falls back to a full decode. Without libjpeg (qmake CONFIG+=no_libjpeg)
+ * isAvailable() is false and open() always fails.
+ */
+class JpegRegionEditor
+{
+public:
+    JpegRegionEditor();
+    ~JpegRegionEditor();
+
+    static bool isAvailable();
+
+    bool open(const QByteArray &data);
+    QSize size() const;
+
+    /* open() in two steps, to know the memory before it is allocated:
+     * size() and bufferedBytes() are valid after readHeader().
+     */
+    bool readHeader(const QByteArray &data);
+    bool readCoefficients();
+    // the coefficients of all components, held until the editor goes
+    qint64 bufferedBytes() const;
+
+    // sprite and pos as given by RenderPlan::sprite()
+    bool apply(const QImage &sprite, const QPoint &pos, qreal opacity);
+    bool write(QByteArray *out);
+
+    // output options, by default the file is written like it was read
+    void setProgressive(bool p);
+    void setOptimized(bool o);
+    // APPn and COM markers other than the ICC profile
+    void setKeepMetadata(bool k);
+
+    QString errorString() const;
+
+private:
+    JpegRegionEditorPrivate *d;
+
+    Q_DISABLE_COPY(JpegRegionEditor)
+};
+
+#endif // JPEGREGION_H
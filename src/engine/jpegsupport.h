@@ -0,0 +1,102 @@
+#ifndef JPEGSUPPORT_H
+#define JPEGSUPPORT_H
+
+/* libjpeg glue shared by the JPEG code of the engine. Only include it
+ * from sources built with HAVE_LIBJPEG.
+ */
+
+#include <QtGlobal>
+
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+
+extern "C" {
+#include <jpeglib.h>
+}
+
+
+/* libjpeg reports fatal errors through error_exit(), which must not
+ * return. Every function calling into libjpeg sets the jump point
+ * itself and keeps only plain data on its frame, so the longjmp never
+ * skips a destructor.
+ */
+struct JpegErrorManager
+{
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+};
+
+inline void jpegErrorExit(j_common_ptr cinfo)
+{
+    JpegErrorManager *err = reinterpret_cast<JpegErrorManager *>(cinfo->err);
+    (*cinfo->err->format_message)(cinfo, err->message);
+    longjmp(err->jump, 1);
+}
+
+inline void jpegOutputMessage(j_common_ptr)
+{
+    // corrupt-data warnings are not interesting here
+}
+
+inline void jpegInitErrorManager(JpegErrorManager *err)
+{
+    std::memset(err, 0, sizeof(*err));
+    jpeg_std_error(&err->pub);
+    err->pub.error_exit = jpegErrorExit;
+    err->pub.output_message = jpegOutputMessage;
+}
+
+// keep EXIF, ICC profiles and comments for jpegCopyMarkers()
+inline void jpegSaveMarkers(j_decompress_ptr src)
+{
+    jpeg_save_markers(src, JPEG_COM, 0xFFFF);
+    for (int m = 0; m < 16; ++m)
+        jpeg_save_markers(src, JPEG_APP0 + m, 0xFFFF);
+}
+
+/* Bytes of the coefficient arrays libjpeg keeps for the whole image,
+ * allocated by jpeg_read_coefficients(), or by jpeg_start_decompress()
+ * for a multi-scan file. Known after jpeg_read_header(): a 4:4:4 YCbCr
+ * file takes 6 bytes a pixel, 4:2:0 one 3.
+ */
+inline qint64 jpegCoefficientBytes(j_decompress_ptr src)
+{
+    qint64 bytes = 0;
+    for (int c = 0; c < src->num_components; ++c)
+    {
+        const jpeg_component_info *ci = src->comp_info + c;
+        // the arrays are padded to whole MCUs
+        const qint64 columns = (ci->width_in_blocks + ci->h_samp_factor - 1)
+                               / ci->h_samp_factor * ci->h_samp_factor;
+        const qint64 rows = (ci->height_in_blocks + ci->v_samp_factor - 1)
+                            / ci->v_samp_factor * ci->v_samp_factor;
+        bytes += columns * rows * DCTSIZE2 * sizeof(JCOEF);
+    }
+    return bytes;
+}
+
+/* Call after jpeg_start_compress() or jpeg_write_coefficients().
+ * libjpeg writes its own JFIF and Adobe markers, everything else is
+ * copied; without keepMetadata only the ICC profile is.
+ */
+inline void jpegCopyMarkers(j_decompress_ptr src, j_compress_ptr dst, bool keepMetadata)
+{
+    for (jpeg_saved_marker_ptr m = src->marker_list; m; m = m->next)
+    {
+        if (dst->write_JFIF_header && m->marker == JPEG_APP0
+                && m->data_length >= 5 && std::memcmp(m->data, "JFIF", 5) == 0)
+            continue;
+        if (dst->write_Adobe_marker && m->marker == JPEG_APP0 + 14
+                && m->data_length >= 5 && std::memcmp(m->data, "Adobe", 5) == 0)
+            continue;
+        if (!keepMetadata
+                && !(m->marker == JPEG_APP0 + 2 && m->data_length >= 12
+                     && std::memcmp(m->data, "ICC_PROFILE", 12) == 0))
+            continue;
+        jpeg_write_marker(dst, m->marker, m->data, m->data_length);
+    }
+}
+
+#endif // JPEGSUPPORT_H
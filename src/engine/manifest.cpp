@@ -0,0 +1,137 @@
+#include <QtDebug>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+
+#include "manifest.h"
+#include "fileutil.h"
+
+
+static const quint32 s_magic = 0x51574d46; // "QWMF"
+static const quint32 s_version = 1;
+
+static QDataStream &operator<<(QDataStream &s, const Manifest::Entry &e)
+{
+    return s << e.mtime << e.size << e.hash << e.profile << qint32(e.position);
+}
+
+static QDataStream &operator>>(QDataStream &s, Manifest::Entry &e)
+{
+    qint32 position;
+    s >> e.mtime >> e.size >> e.hash >> e.profile >> position;
+    e.position = position;
+    return s;
+}
+
+Manifest::Manifest()
+    : m_dirty(false)
+{
+}
+
+QString Manifest::fileName()
+{
+    return ".qwatermark-manifest";
+}
+
+QByteArray Manifest::hash(const QByteArray &data)
+{
+    return QCryptographicHash::hash(data, QCryptographicHash::Md5);
+}
+
+bool Manifest::load(const QString &destinationRoot)
+{
+    QMutexLocker locker(&m_mutex);
+
+    m_path = QDir(destinationRoot).filePath(fileName());
+    m_entries.clear();
+    m_dirty = false;
+
+    QFile f(m_path);
+    if (!f.exists())
+        return true;
+    if (!f.open(QIODevice::ReadOnly))
+    {
+        qDebug() << "Cannot open manifest" << m_path;
+        return false;
+    }
+
+    QDataStream s(&f);
+    s.setVersion(QDataStream::Qt_4_6);
+
+    quint32 magic, version;
+    s >> magic >> version;
+    if (magic != s_magic || version != s_version)
+    {
+        qDebug() << "Ignoring manifest with unknown format" << m_path;
+        return false;
+    }
+
+    QHash<QString, Entry> entries;
+    s >> entries;
+    if (s.status() != QDataStream::Ok)
+    {
+        qDebug() << "Corrupted manifest" << m_path;
+        return false;
+    }
+
+    m_entries = entries;
+    return true;
+}
+
+bool Manifest::save()
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (!m_dirty || m_path.isEmpty())
+        return true;
+
+    // write aside and swap, a crash must not leave a truncated manifest
+    QString tmpPath = m_path + ".tmp";
+    QFile f(tmpPath);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qDebug() << "Cannot write manifest" << tmpPath;
+        return false;
+    }
+
+    QDataStream s(&f);
+    s.setVersion(QDataStream::Qt_4_6);
+    s << s_magic << s_version << m_entries;
+    f.close();
+
+    if (s.status() != QDataStream::Ok || f.error() != QFile::NoError)
+    {
+        QFile::remove(tmpPath);
+        return false;
+    }
+
+    if (!replaceFile(tmpPath, m_path))
+    {
+        QFile::remove(tmpPath);
+        return false;
+    }
+
+    m_dirty = false;
+    return true;
+}
+
+bool Manifest::lookup(const QString &source, Entry *entry) const
+{
+    QMutexLocker locker(&m_mutex);
+
+    QHash<QString, Entry>::const_iterator it = m_entries.constFind(source);
+    if (it == m_entries.constEnd())
+        return false;
+
+    *entry = it.value();
+    return true;
+}
+
+void Manifest::insert(const QString &source, const Entry &entry)
+{
+    QMutexLocker locker(&m_mutex);
+
+    m_entries.insert(source, entry);
+    m_dirty = true;
+}
@@ -0,0 +1,47 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QByteArray>
+
+
+/*! Record of the sources already watermarked into a destination folder.
+ *
+ * Stored as a small binary file in the destination root and used by the
+ * incremental mode to skip sources whose content, profile and position
+ * did not change since the last run. All methods are thread safe.
+ */
+class Manifest
+{
+public:
+
+    struct Entry {
+        Entry() : mtime(0), size(0), position(-1) {}
+        qint64 mtime;
+        qint64 size;
+        QByteArray hash;
+        QByteArray profile;
+        int position;
+    };
+
+    Manifest();
+
+    static QString fileName();
+    static QByteArray hash(const QByteArray &data);
+
+    bool load(const QString &destinationRoot);
+    bool save();
+
+    bool lookup(const QString &source, Entry *entry) const;
+    void insert(const QString &source, const Entry &entry);
+
+private:
+    mutable QMutex m_mutex;
+    QString m_path;
+    QHash<QString, Entry> m_entries;
+    bool m_dirty;
+};
+
+#endif // MANIFEST_H
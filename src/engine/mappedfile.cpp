@@ -0,0 +1,58 @@
+#include "mappedfile.h"
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <limits.h>
+
+
+MappedFile::MappedFile(const QString &fileName)
+    : m_file(fileName)
+{
+}
+
+bool MappedFile::open()
+{
+    if (!m_file.open(QIODevice::ReadOnly))
+        return false;
+
+    // QByteArray cannot hold more
+    const qint64 size = m_file.size();
+    if (size > INT_MAX)
+    {
+        m_error = QFile::tr("File too large");
+        m_file.close();
+        return false;
+    }
+
+    uchar *p = size > 0 ? m_file.map(0, size) : 0;
+    if (!p)
+    {
+        m_data = m_file.readAll();
+        return m_file.error() == QFile::NoError;
+    }
+
+#if defined(Q_OS_UNIX) && defined(MADV_SEQUENTIAL)
+    madvise(p, size, MADV_SEQUENTIAL);
+    madvise(p, size, MADV_WILLNEED);
+#endif
+
+    m_data = QByteArray::fromRawData(reinterpret_cast<const char *>(p), int(size));
+    return true;
+}
+
+void MappedFile::prefetch(const QString &fileName)
+{
+#if defined(Q_OS_UNIX) && defined(POSIX_FADV_WILLNEED)
+    int fd = ::open(QFile::encodeName(fileName).constData(), O_RDONLY);
+    if (fd < 0)
+        return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    ::close(fd);
+#else
+    Q_UNUSED(fileName);
+#endif
+}
@@ -0,0 +1,40 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <QByteArray>
+#include <QFile>
+
+
+/*! Read only view of a whole file.
+ *
+ * The file is mapped into memory where possible, so decoding from
+ * data() through a QBuffer reads the page cache directly instead of
+ * copying the file into a buffer first. The kernel is told the mapping
+ * is read sequentially and will be needed soon. When mapping fails the
+ * file is read into memory instead.
+ *
+ * data() shares the mapping without copying it: it is only valid while
+ * the MappedFile exists.
+ */
+class MappedFile
+{
+public:
+    MappedFile(const QString &fileName);
+
+    bool open();
+    QByteArray data() const { return m_data; }
+    QFile::FileError error() const { return m_file.error(); }
+    QString errorString() const { return m_error.isNull() ? m_file.errorString() : m_error; }
+
+    // starts reading a file into the page cache in the background
+    static void prefetch(const QString &fileName);
+
+private:
+    QFile m_file;
+    QByteArray m_data;
+    QString m_error;
+
+    Q_DISABLE_COPY(MappedFile)
+};
+
+#endif // MAPPEDFILE_H
@@ -0,0 +1,78 @@
+#include <QMutexLocker>
+
+#include "memorybudget.h"
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+
+MemoryBudget::MemoryBudget(qint64 limit)
+    : m_limit(limit > 0 ? limit : defaultLimit()),
+      m_used(0)
+{
+}
+
+qint64 MemoryBudget::defaultLimit()
+{
+    const qint64 minimum = qint64(256) * 1024 * 1024;
+    qint64 physical = 0;
+#if defined(Q_OS_UNIX) && defined(_SC_PHYS_PAGES)
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && pageSize > 0)
+        physical = qint64(pages) * pageSize;
+#endif
+    return qMax(minimum, physical / 4);
+}
+
+void MemoryBudget::reset(qint64 limit)
+{
+    QMutexLocker locker(&m_mutex);
+    m_limit = limit > 0 ? limit : defaultLimit();
+    m_used = 0;
+    m_released.wakeAll();
+}
+
+qint64 MemoryBudget::limit() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_limit;
+}
+
+qint64 MemoryBudget::used() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_used;
+}
+
+qint64 MemoryBudget::acquire(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    bytes = qBound(qint64(0), bytes, m_limit);
+    while (m_used > 0 && m_used + bytes > m_limit)
+        m_released.wait(&m_mutex);
+    m_used += bytes;
+    return bytes;
+}
+
+bool MemoryBudget::tryAcquire(qint64 bytes, qint64 *taken)
+{
+    QMutexLocker locker(&m_mutex);
+    bytes = qBound(qint64(0), bytes, m_limit);
+    if (m_used > 0 && m_used + bytes > m_limit)
+        return false;
+    m_used += bytes;
+    *taken = bytes;
+    return true;
+}
+
+void MemoryBudget::release(qint64 bytes)
+{
+    if (bytes <= 0)
+        return;
+
+    QMutexLocker locker(&m_mutex);
+    m_used -= bytes;
+    m_released.wakeAll();
+}
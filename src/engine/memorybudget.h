@@ -0,0 +1,40 @@
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <QMutex>
+#include <QWaitCondition>
+
+
+/*! Bytes of decoded image data the engine may hold at once.
+ *
+ * acquire() blocks until the requested amount fits next to what the
+ * other images hold. A request larger than the whole budget is clamped
+ * to it, so an oversized image still runs, just alone. All methods are
+ * thread safe.
+ */
+class MemoryBudget
+{
+public:
+    MemoryBudget(qint64 limit = 0);
+
+    // a quarter of the physical memory, at least 256 MB
+    static qint64 defaultLimit();
+
+    void reset(qint64 limit);
+    qint64 limit() const;
+    qint64 used() const;
+
+    // returns the amount actually taken, pass it to release()
+    qint64 acquire(qint64 bytes);
+    // acquire() without waiting, false when the bytes do not fit now
+    bool tryAcquire(qint64 bytes, qint64 *taken);
+    void release(qint64 bytes);
+
+private:
+    mutable QMutex m_mutex;
+    QWaitCondition m_released;
+    qint64 m_limit;
+    qint64 m_used;
+};
+
+#endif // MEMORYBUDGET_H
@@ -0,0 +1,642 @@
+#include <QIODevice>
+#include <QList>
+#include <QPair>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+#if QT_VERSION >= 0x050E00
+#include <QColorSpace>
+#endif
+
+#include "pngencoder.h"
+
+#ifdef HAVE_ZLIB
+
+#include <cstdlib>
+#include <cstring>
+#include <zlib.h>
+
+
+static const int s_chunkBytes = 256 * 1024;
+static const int s_window = 32 * 1024;
+
+// the PNG colour types written
+enum {
+    PngGray = 0,
+    PngRgb = 2,
+    PngPalette = 3,
+    PngRgba = 6
+};
+
+static int bytesPerPixel(int colorType)
+{
+    switch (colorType)
+    {
+    case PngRgb:
+        return 3;
+    case PngRgba:
+        return 4;
+    }
+    return 1;
+}
+
+static inline void putUInt32(uchar *p, quint32 v)
+{
+    p[0] = uchar(v >> 24);
+    p[1] = uchar(v >> 16);
+    p[2] = uchar(v >> 8);
+    p[3] = uchar(v);
+}
+
+/* The bytes of one scanline: the gray levels or palette indexes of an
+ * 8 bit image as they are, RGB or RGBA out of a 32 bit one.
+ */
+static void rawRow(const QImage &image, int y, int colorType, uchar *out)
+{
+    if (colorType == PngGray || colorType == PngPalette)
+    {
+        std::memcpy(out, image.constScanLine(y), image.width());
+        return;
+    }
+
+    const bool alpha = colorType == PngRgba;
+    const QRgb *line = reinterpret_cast<const QRgb *>(image.constScanLine(y));
+    for (int x = 0; x < image.width(); ++x)
+    {
+        *out++ = uchar(qRed(line[x]));
+        *out++ = uchar(qGreen(line[x]));
+        *out++ = uchar(qBlue(line[x]));
+        if (alpha)
+            *out++ = uchar(qAlpha(line[x]));
+    }
+}
+
+static inline uchar paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = std::abs(p - a);
+    int pb = std::abs(p - b);
+    int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return uchar(a);
+    return uchar(pb <= pc ? b : c);
+}
+
+static inline uchar filtered(int type, const uchar *row, const uchar *prev, int i, int bpp)
+{
+    int a = i >= bpp ? row[i - bpp] : 0;
+    int b = prev ? prev[i] : 0;
+    int c = prev && i >= bpp ? prev[i - bpp] : 0;
+    switch (type)
+    {
+    case 1:
+        return uchar(row[i] - a);
+    case 2:
+        return uchar(row[i] - b);
+    case 3:
+        return uchar(row[i] - ((a + b) >> 1));
+    case 4:
+        return uchar(row[i] - paeth(a, b, c));
+    }
+    return row[i];
+}
+
+/* Writes the filter byte and the filtered row to out. The filter is
+ * chosen per row with the usual minimum sum of absolute differences
+ * heuristic, like libpng does; palette indexes are not filtered, their
+ * differences mean nothing.
+ */
+static void filterRow(const uchar *row, const uchar *prev, int n, int colorType, uchar *out)
+{
+    const int bpp = bytesPerPixel(colorType);
+    int best = 0;
+    quint64 bestSum = ~quint64(0);
+    for (int type = 0; type < 5 && colorType != PngPalette; ++type)
+    {
+        quint64 sum = 0;
+        for (int i = 0; i < n && sum < bestSum; ++i)
+            sum += std::abs(int(qint8(filtered(type, row, prev, i, bpp))));
+        if (sum < bestSum)
+        {
+            bestSum = sum;
+            best = type;
+        }
+    }
+
+    out[0] = uchar(best);
+    for (int i = 0; i < n; ++i)
+        out[i + 1] = filtered(best, row, prev, i, bpp);
+}
+
+/*! Deflates the filtered rows [first, last) into a raw deflate piece.
+ */
+class PngChunk : public QRunnable
+{
+public:
+    PngChunk(const QImage &image, int colorType, int first, int last, int level, bool final, QSemaphore *done)
+        : adler(adler32(0, Z_NULL, 0)),
+          length(0),
+          ok(false),
+          m_image(image),
+          m_colorType(colorType),
+          m_first(first),
+          m_last(last),
+          m_level(level),
+          m_final(final),
+          m_done(done)
+    {
+        setAutoDelete(false);
+    }
+
+    void run()
+    {
+        ok = deflateRows();
+        if (m_done)
+            m_done->release();
+    }
+
+    QByteArray out;
+    uLong adler;
+    qint64 length;
+    bool ok;
+
+private:
+    QImage m_image;
+    int m_colorType;
+    int m_first;
+    int m_last;
+    int m_level;
+    bool m_final;
+    QSemaphore *m_done;
+
+    bool deflateRows();
+};
+
+bool PngChunk::deflateRows()
+{
+    const int n = m_image.width() * bytesPerPixel(m_colorType);
+
+    z_stream zs;
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    if (deflateInit2(&zs, m_level, Z_DEFLATED, -MAX_WBITS, 8,
+                     m_level ? Z_FILTERED : Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    QByteArray rows[2];
+    rows[0].resize(n);
+    rows[1].resize(n);
+    QByteArray line(n + 1, 0);
+    uchar *cur = reinterpret_cast<uchar *>(rows[0].data());
+    uchar *prev = reinterpret_cast<uchar *>(rows[1].data());
+
+    // prime the window with the tail of the data before this chunk
+    if (m_first > 0)
+    {
+        int y = m_first - qMin(m_first, s_window / (n + 1) + 1);
+        if (y > 0)
+            rawRow(m_image, y - 1, m_colorType, prev);
+
+        QByteArray dict;
+        for (; y < m_first; ++y)
+        {
+            rawRow(m_image, y, m_colorType, cur);
+            filterRow(cur, y > 0 ? prev : 0, n, m_colorType, reinterpret_cast<uchar *>(line.data()));
+            dict.append(line);
+            qSwap(cur, prev);
+        }
+        if (dict.size() > s_window)
+            dict = dict.right(s_window);
+        deflateSetDictionary(&zs, reinterpret_cast<const Bytef *>(dict.constData()), dict.size());
+    }
+
+    QByteArray buffer(64 * 1024, 0);
+    int rc = Z_OK;
+    for (int y = m_first; y < m_last; ++y)
+    {
+        rawRow(m_image, y, m_colorType, cur);
+        filterRow(cur, y > 0 ? prev : 0, n, m_colorType, reinterpret_cast<uchar *>(line.data()));
+        qSwap(cur, prev);
+
+        adler = adler32(adler, reinterpret_cast<const Bytef *>(line.constData()), line.size());
+        length += line.size();
+
+        int flush = y + 1 < m_last ? Z_NO_FLUSH : (m_final ? Z_FINISH : Z_SYNC_FLUSH);
+        zs.next_in = reinterpret_cast<Bytef *>(line.data());
+        zs.avail_in = line.size();
+        do
+        {
+            zs.next_out = reinterpret_cast<Bytef *>(buffer.data());
+            zs.avail_out = buffer.size();
+            rc = deflate(&zs, flush);
+            if (rc == Z_STREAM_ERROR)
+                break;
+            out.append(buffer.constData(), buffer.size() - zs.avail_out);
+        } while (zs.avail_out == 0);
+    }
+
+    deflateEnd(&zs);
+    return rc != Z_STREAM_ERROR && (!m_final || rc == Z_STREAM_END);
+}
+
+static bool writeChunk(QIODevice *device, const char *type, const QByteArray &data)
+{
+    uchar header[8];
+    putUInt32(header, data.size());
+    std::memcpy(header + 4, type, 4);
+
+    uLong crc = crc32(0, header + 4, 4);
+    crc = crc32(crc, reinterpret_cast<const Bytef *>(data.constData()), data.size());
+    uchar trailer[4];
+    putUInt32(trailer, crc);
+
+    return device->write(reinterpret_cast<const char *>(header), 8) == 8
+            && device->write(data) == data.size()
+            && device->write(reinterpret_cast<const char *>(trailer), 4) == 4;
+}
+
+/* What goes before the image data. The palette is QImage's colour
+ * table, the ICC profile is written as it is given.
+ */
+struct PngHeader
+{
+    PngHeader() : width(0), height(0), colorType(PngRgb), dpmX(0), dpmY(0) {}
+
+    int width;
+    int height;
+    int colorType;
+    QVector<QRgb> palette;
+    int dpmX;
+    int dpmY;
+    QList<QPair<QByteArray, QByteArray> > text;
+    QByteArray icc;
+};
+
+static bool writeHeader(QIODevice *device, const PngHeader &header)
+{
+    static const char signature[8] = { char(0x89), 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    if (device->write(signature, 8) != 8)
+        return false;
+
+    QByteArray ihdr(13, 0);
+    uchar *p = reinterpret_cast<uchar *>(ihdr.data());
+    putUInt32(p, header.width);
+    putUInt32(p + 4, header.height);
+    p[8] = 8;               // bit depth
+    p[9] = uchar(header.colorType);
+    if (!writeChunk(device, "IHDR", ihdr))
+        return false;
+
+    // before PLTE and IDAT
+    if (!header.icc.isEmpty())
+    {
+        uLongf size = compressBound(header.icc.size());
+        // keyword, its terminator and compression method 0
+        QByteArray iccp("ICC profile\0\0", 13);
+        iccp.resize(13 + size);
+        if (compress2(reinterpret_cast<Bytef *>(iccp.data() + 13), &size,
+                      reinterpret_cast<const Bytef *>(header.icc.constData()), header.icc.size(), 9) != Z_OK)
+            return false;
+        iccp.resize(13 + size);
+        if (!writeChunk(device, "iCCP", iccp))
+            return false;
+    }
+
+    if (header.colorType == PngPalette)
+    {
+        QByteArray plte;
+        QByteArray trns;
+        for (int i = 0; i < header.palette.size(); ++i)
+        {
+            QRgb c = header.palette.at(i);
+            plte.append(char(qRed(c))).append(char(qGreen(c))).append(char(qBlue(c)));
+            trns.append(char(qAlpha(c)));
+        }
+        // tRNS may stop at the last translucent entry
+        while (!trns.isEmpty() && uchar(trns.at(trns.size() - 1)) == 255)
+            trns.chop(1);
+
+        if (!writeChunk(device, "PLTE", plte))
+            return false;
+        if (!trns.isEmpty() && !writeChunk(device, "tRNS", trns))
+            return false;
+    }
+
+    if (header.dpmX > 0 && header.dpmY > 0)
+    {
+        QByteArray phys(9, 0);
+        p = reinterpret_cast<uchar *>(phys.data());
+        putUInt32(p, header.dpmX);
+        putUInt32(p + 4, header.dpmY);
+        p[8] = 1;           // meters
+        if (!writeChunk(device, "pHYs", phys))
+            return false;
+    }
+
+    for (int i = 0; i < header.text.size(); ++i)
+    {
+        if (header.text.at(i).first.isEmpty())
+            continue;
+        if (!writeChunk(device, "tEXt", header.text.at(i).first + '\0' + header.text.at(i).second))
+            return false;
+    }
+
+    return true;
+}
+
+
+/* State of a begin() ... finish() encoding: one deflate stream, the
+ * previous row for the filters and the output flushed to IDAT chunks
+ * whenever the buffer fills.
+ */
+struct PngStream
+{
+    z_stream zs;
+    QIODevice *device;
+    bool alpha;
+    int width;
+    int rowsLeft;
+    QByteArray rows[2];
+    QByteArray line;
+    QByteArray buffer;
+    bool first;
+};
+
+static bool deflateLine(PngStream *st, int flush)
+{
+    int rc;
+    do
+    {
+        rc = deflate(&st->zs, flush);
+        if (rc == Z_STREAM_ERROR)
+            return false;
+        // IDAT chunks of the full buffer size, the last one whatever is left
+        if (st->zs.avail_out == 0 || (flush == Z_FINISH && rc == Z_STREAM_END))
+        {
+            QByteArray data = st->buffer.left(st->buffer.size() - st->zs.avail_out);
+            if (!writeChunk(st->device, "IDAT", data))
+                return false;
+            st->zs.next_out = reinterpret_cast<Bytef *>(st->buffer.data());
+            st->zs.avail_out = st->buffer.size();
+        }
+    } while (flush == Z_FINISH ? rc != Z_STREAM_END : st->zs.avail_in > 0);
+
+    return true;
+}
+
+
+PngEncoder::PngEncoder()
+    : m_compression(6),
+      m_maxThreads(qMax(1, QThread::idealThreadCount())),
+      m_stream(0)
+{
+}
+
+PngEncoder::~PngEncoder()
+{
+    if (m_stream)
+    {
+        deflateEnd(&m_stream->zs);
+        delete m_stream;
+    }
+}
+
+bool PngEncoder::isAvailable()
+{
+    return true;
+}
+
+bool PngEncoder::write(const QImage &source, QIODevice *device)
+{
+    if (source.isNull())
+    {
+        m_error = QObject::tr("Null image");
+        return false;
+    }
+
+    // gray and palette images stay what they are, like Qt's own writer keeps them
+    PngHeader header;
+    QImage image;
+    switch (source.format())
+    {
+#if QT_VERSION >= 0x050500
+    case QImage::Format_Grayscale8:
+        image = source;
+        header.colorType = PngGray;
+        break;
+#endif
+    case QImage::Format_Mono:
+    case QImage::Format_MonoLSB:
+    case QImage::Format_Indexed8:
+        if (source.colorCount() > 0)
+        {
+            image = source.convertToFormat(QImage::Format_Indexed8);
+            header.colorType = PngPalette;
+            header.palette = image.colorTable();
+            break;
+        }
+        // without a colour table the indexes mean nothing, fall through
+    default:
+        header.colorType = source.hasAlphaChannel() ? PngRgba : PngRgb;
+        image = source.convertToFormat(header.colorType == PngRgba ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+        break;
+    }
+
+    const int w = image.width();
+    const int h = image.height();
+    const int rowBytes = w * bytesPerPixel(header.colorType) + 1;
+
+    header.width = w;
+    header.height = h;
+    header.dpmX = image.dotsPerMeterX();
+    header.dpmY = image.dotsPerMeterY();
+    foreach (QString key, image.textKeys())
+        header.text << qMakePair(key.left(79).toLatin1(), image.text(key).toLatin1());
+#if QT_VERSION >= 0x050E00
+    if (source.colorSpace().isValid())
+        header.icc = source.colorSpace().iccProfile();
+#endif
+
+    bool ok = writeHeader(device, header);
+
+    // every thread gets a couple of chunks so a slow one does not stall the rest
+    int chunks = qBound(1, int(qint64(rowBytes) * h / s_chunkBytes), 2 * m_maxThreads);
+    chunks = qMin(chunks, h);
+
+    QSemaphore done;
+    QList<PngChunk *> pieces;
+    for (int i = 0; i < chunks; ++i)
+    {
+        int first = qint64(h) * i / chunks;
+        int last = qint64(h) * (i + 1) / chunks;
+        pieces << new PngChunk(image, header.colorType, first, last, m_compression, i == chunks - 1,
+                               i ? &done : 0);
+    }
+    for (int i = 1; i < chunks; ++i)
+        QThreadPool::globalInstance()->start(pieces.at(i));
+    pieces.at(0)->run();
+
+    done.acquire(chunks - 1);
+
+    QByteArray zlibHeader("\x78\x9c", 2);
+    uLong adler = adler32(0, Z_NULL, 0);
+    for (int i = 0; i < chunks; ++i)
+    {
+        PngChunk *c = pieces.at(i);
+        ok = ok && c->ok;
+        if (!ok)
+            break;
+
+        adler = adler32_combine(adler, c->adler, c->length);
+        QByteArray data = c->out;
+        if (i == 0)
+            data.prepend(zlibHeader);
+        if (i == chunks - 1)
+        {
+            uchar trailer[4];
+            putUInt32(trailer, adler);
+            data.append(reinterpret_cast<const char *>(trailer), 4);
+        }
+        ok = writeChunk(device, "IDAT", data);
+    }
+    qDeleteAll(pieces);
+
+    ok = ok && writeChunk(device, "IEND", QByteArray());
+    if (!ok)
+        m_error = device->errorString().isEmpty() ? QObject::tr("PNG compression failed") : device->errorString();
+    return ok;
+}
+
+bool PngEncoder::begin(const QSize &size, bool alpha, QIODevice *device)
+{
+    Q_ASSERT(!m_stream);
+
+    PngHeader header;
+    header.width = size.width();
+    header.height = size.height();
+    header.colorType = alpha ? PngRgba : PngRgb;
+    if (!writeHeader(device, header))
+    {
+        m_error = device->errorString();
+        return false;
+    }
+
+    m_stream = new PngStream;
+    m_stream->zs.zalloc = Z_NULL;
+    m_stream->zs.zfree = Z_NULL;
+    m_stream->zs.opaque = Z_NULL;
+    if (deflateInit2(&m_stream->zs, m_compression, Z_DEFLATED, MAX_WBITS, 8,
+                     m_compression ? Z_FILTERED : Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        delete m_stream;
+        m_stream = 0;
+        m_error = QObject::tr("PNG compression failed");
+        return false;
+    }
+
+    const int n = size.width() * (alpha ? 4 : 3);
+    m_stream->device = device;
+    m_stream->alpha = alpha;
+    m_stream->width = size.width();
+    m_stream->rowsLeft = size.height();
+    m_stream->rows[0].resize(n);
+    m_stream->rows[1].resize(n);
+    m_stream->line.resize(n + 1);
+    m_stream->buffer.resize(256 * 1024);
+    m_stream->zs.next_out = reinterpret_cast<Bytef *>(m_stream->buffer.data());
+    m_stream->zs.avail_out = m_stream->buffer.size();
+    m_stream->first = true;
+    return true;
+}
+
+bool PngEncoder::writeRows(const QImage &band)
+{
+    Q_ASSERT(m_stream && band.width() == m_stream->width);
+
+    PngStream *st = m_stream;
+    const int n = st->line.size() - 1;
+    const int colorType = st->alpha ? PngRgba : PngRgb;
+    for (int y = 0; y < band.height() && st->rowsLeft > 0; ++y, --st->rowsLeft)
+    {
+        uchar *cur = reinterpret_cast<uchar *>(st->rows[0].data());
+        uchar *prev = reinterpret_cast<uchar *>(st->rows[1].data());
+        rawRow(band, y, colorType, cur);
+        filterRow(cur, st->first ? 0 : prev, n, colorType, reinterpret_cast<uchar *>(st->line.data()));
+        qSwap(st->rows[0], st->rows[1]);
+        st->first = false;
+
+        st->zs.next_in = reinterpret_cast<Bytef *>(st->line.data());
+        st->zs.avail_in = st->line.size();
+        if (!deflateLine(st, Z_NO_FLUSH))
+        {
+            m_error = st->device->errorString();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool PngEncoder::finish()
+{
+    Q_ASSERT(m_stream);
+
+    PngStream *st = m_stream;
+    st->zs.next_in = Z_NULL;
+    st->zs.avail_in = 0;
+    bool ok = st->rowsLeft == 0
+              && deflateLine(st, Z_FINISH)
+              && writeChunk(st->device, "IEND", QByteArray());
+    if (!ok)
+        m_error = st->device->errorString().isEmpty() ? QObject::tr("PNG compression failed") : st->device->errorString();
+
+    deflateEnd(&st->zs);
+    delete st;
+    m_stream = 0;
+    return ok;
+}
+
+#else // HAVE_ZLIB
+
+PngEncoder::PngEncoder()
+    : m_compression(6),
+      m_maxThreads(1),
+      m_stream(0)
+{
+}
+
+bool PngEncoder::isAvailable()
+{
+    return false;
+}
+
+PngEncoder::~PngEncoder()
+{
+}
+
+bool PngEncoder::write(const QImage &, QIODevice *)
+{
+    m_error = QObject::tr("Built without zlib");
+    return false;
+}
+
+bool PngEncoder::begin(const QSize &, bool, QIODevice *)
+{
+    m_error = QObject::tr("Built without zlib");
+    return false;
+}
+
+bool PngEncoder::writeRows(const QImage &)
+{
+    return false;
+}
+
+bool PngEncoder::finish()
+{
+    return false;
+}
+
+#endif // HAVE_ZLIB
@@ -0,0 +1,63 @@
+#ifndef PNGENCODER_H
+#define PNGENCODER_H
+
+#include <QImage>
+#include <QString>
+
+class QIODevice;
+struct PngStream;
+
+
+/*! PNG writer deflating the image data in parallel.
+ *
+ * The filtered scanlines are cut into chunks of a few hundred KB which
+ * are compressed independently on the global thread pool. Every chunk
+ * is primed with the last 32 KB of the data before it and ends on a
+ * sync flush, so the pieces simply concatenate into one zlib stream and
+ * the ratio stays within a fraction of a percent of a serial encoder.
+ * The Adler-32 checksums of the chunks are combined at the end.
+ *
+ * begin(), writeRows() and finish() write an image band by band on the
+ * calling thread instead, for images too large to hold in memory.
+ *
+ * write() keeps 8 bit grayscale and palette images (1 bit ones become
+ * 8 bit palettes) and writes anything else as 8 bit RGB or RGBA. The
+ * image text keys, the resolution and, with Qt 5.14, the ICC profile of
+ * the colour space are kept. The banded path writes RGB or RGBA
+ * without any of those. Without zlib (qmake CONFIG+=no_zlib)
+ * isAvailable() is false and the caller should use QImageWriter.
+ */
+class PngEncoder
+{
+public:
+    PngEncoder();
+    ~PngEncoder();
+
+    static bool isAvailable();
+
+    // zlib level, 0..9
+    int compression() const { return m_compression; }
+    void setCompression(int level) { m_compression = qBound(0, level, 9); }
+
+    int maxThreads() const { return m_maxThreads; }
+    void setMaxThreads(int c) { m_maxThreads = qMax(1, c); }
+
+    bool write(const QImage &image, QIODevice *device);
+
+    bool begin(const QSize &size, bool alpha, QIODevice *device);
+    // the next rows, RGB32 or ARGB32 as given to begin()
+    bool writeRows(const QImage &band);
+    bool finish();
+
+    QString errorString() const { return m_error; }
+
+private:
+    int m_compression;
+    int m_maxThreads;
+    QString m_error;
+    PngStream *m_stream;
+
+    Q_DISABLE_COPY(PngEncoder)
+};
+
+#endif // PNGENCODER_H
@@ -0,0 +1,536 @@
+#include <QtDebug>
+#include <QSettings>
+#include <QFileInfo>
+#include <QFontMetrics>
+#include <QCoreApplication>
+#include <QPainter>
+#include <QCache>
+#include <QCryptographicHash>
+#include <qmath.h>
+
+#include "profile.h"
+#include "imageprobe.h"
+#include "profileregistry.h"
+
+
+/* Text sprites of all profiles, keyed by fingerprint and target size.
+ * QCache drops the least recently used sprites once their total byte
+ * size exceeds the cost limit.
+ */
+struct TextSpriteCache
+{
+    TextSpriteCache() : cache(64 * 1024 * 1024) {}
+
+    QMutex mutex;
+    QCache<QByteArray, Profile::TextSprite> cache;
+};
+
+Q_GLOBAL_STATIC(TextSpriteCache, textSpriteCache)
+
+static const int s_bucketsPerOctave = 16;
+// 1/256 .. 256 times the native size
+static const int s_maxBucket = 8 * s_bucketsPerOctave;
+
+
+int Profile::Scaling::bucket(const QSize &native, int w, int h) const
+{
+    if (native.isEmpty() || w <= 0 || h <= 0 || percent <= 0)
+        return 0;
+
+    // the side of the watermark measured and the length it should have
+    int side = 0;
+    qreal target = 0;
+    switch (mode)
+    {
+    case Profile::NativeSize:
+        return 0;
+    case Profile::PercentOfWidth:
+        side = native.width();
+        target = w * percent / 100;
+        break;
+    case Profile::PercentOfHeight:
+        side = native.height();
+        target = h * percent / 100;
+        break;
+    case Profile::PercentOfShortEdge:
+        side = qMax(native.width(), native.height());
+        target = qMin(w, h) * percent / 100;
+        break;
+    }
+
+    if (maximum > 0)
+        target = qMin(target, qreal(maximum));
+    if (minimum > 0)
+        target = qMax(target, qreal(minimum));
+    if (target < 1)
+        target = 1;
+
+    int b = qRound(qLn(target / side) / qLn(2.0) * s_bucketsPerOctave);
+    // rounding to the bucket may step over a clamp
+    if (maximum > 0 && side * factor(b) > maximum + 0.5)
+        --b;
+    if (minimum > 0 && side * factor(b) < minimum - 0.5)
+        ++b;
+
+    return qBound(-s_maxBucket, b, s_maxBucket);
+}
+
+qreal Profile::Scaling::factor(int bucket)
+{
+    return bucket ? qPow(2.0, qreal(bucket) / s_bucketsPerOctave) : 1.0;
+}
+
+QSize Profile::Scaling::scaled(const QSize &native, int bucket)
+{
+    if (bucket == 0 || native.isEmpty())
+        return native;
+
+    qreal f = factor(bucket);
+    return QSize(qMax(1, qRound(native.width() * f)), qMax(1, qRound(native.height() * f)));
+}
+
+bool Profile::Scaling::operator!=(const Scaling &other) const
+{
+    return     mode != other.mode
+            || !qFuzzyCompare(percent, other.percent)
+            || minimum != other.minimum
+            || maximum != other.maximum;
+}
+
+
+QStringList Profile::getProfiles()
+{
+    return ProfileRegistry::instance()->names();
+}
+
+Profile Profile::getProfile(const QString &name)
+{
+    return ProfileRegistry::instance()->profile(name);
+}
+
+Profile::Profile(const QString &name)
+    : m_name(name),
+      m_logoCache(new LogoCache)
+{
+    load();
+}
+
+bool Profile::isValid()
+{
+    return (m_type == Profile::Text && !m_watermarkText.isEmpty())
+            || (m_type == Profile::Image && QFileInfo(m_watermarkImage).exists());
+}
+
+void Profile::load()
+{
+    QSettings s;
+    s.beginGroup(m_name);
+
+    m_type = s.value("type", "text").toString() == "image" ? Profile::Image : Profile::Text;
+
+    m_watermarkText = s.value("text", QCoreApplication::applicationName() + " " + QCoreApplication::applicationVersion()).toString();
+    m_watermarkImage = s.value("image").toString();
+    m_logoCache = QSharedPointer<LogoCache>(new LogoCache);
+
+    m_marginHorizontal = s.value("marginHorizontal", 10).toInt();
+    m_marginVertical = s.value("marginVertical", 10).toInt();
+
+    m_transparency = s.value("transparency", 0.5).toReal();
+
+    QString fontStr = s.value("font", "n/a").toString();
+    if (fontStr == "n/a")
+    {
+        m_font = QFont();
+        m_font.setPointSize(48);
+    }
+    else
+        m_font.fromString(fontStr);
+
+    m_mainColor = QColor(s.value("mainColor", "#ffffff").toString());
+    m_outlineColor = QColor(s.value("outlineColor", "#000000").toString());
+
+    m_outlineSize = s.value("outlineSize", 2).toInt();
+
+    m_outputFormat = formatFromName(s.value("outputFormat", "keep").toString());
+    setQuality(s.value("quality", 90).toInt());
+    setPngCompression(s.value("pngCompression", 6).toInt());
+    m_progressive = s.value("progressive", false).toBool();
+    m_optimizeHuffman = s.value("optimizeHuffman", true).toBool();
+    m_metadataPolicy = s.value("metadata", "keep").toString() == "strip" ? Profile::StripMetadata : Profile::KeepMetadata;
+    m_parallelPng = s.value("parallelPng", true).toBool();
+
+    m_scaling.mode = scaleModeFromName(s.value("scaleMode", "native").toString());
+    m_scaling.percent = qBound(0.1, s.value("scalePercent", 10.0).toReal(), 100.0);
+    m_scaling.minimum = qMax(0, s.value("scaleMin", 0).toInt());
+    m_scaling.maximum = qMax(0, s.value("scaleMax", 0).toInt());
+
+    s.endGroup();
+}
+
+void Profile::save()
+{
+    QSettings s;
+    s.beginGroup(m_name);
+
+    s.setValue("type", m_type == Profile::Image ? "image" : "text");
+    s.setValue("is_profile", true);
+
+    s.setValue("text", m_watermarkText);
+    s.setValue("image", m_watermarkImage);
+
+    s.setValue("marginHorizontal", m_marginHorizontal);
+    s.setValue("marginVertical", m_marginVertical);
+
+    s.setValue("transparency", m_transparency);
+
+    s.setValue("font", m_font.toString());
+
+    s.setValue("mainColor", m_mainColor.name());
+    s.setValue("outlineColor", m_outlineColor.name());
+    s.setValue("outlineSize", m_outlineSize);
+
+    s.setValue("outputFormat", formatName(m_outputFormat));
+    s.setValue("quality", m_quality);
+    s.setValue("pngCompression", m_pngCompression);
+    s.setValue("progressive", m_progressive);
+    s.setValue("optimizeHuffman", m_optimizeHuffman);
+    s.setValue("metadata", m_metadataPolicy == Profile::StripMetadata ? "strip" : "keep");
+    s.setValue("parallelPng", m_parallelPng);
+
+    s.setValue("scaleMode", scaleModeName(m_scaling.mode));
+    s.setValue("scalePercent", m_scaling.percent);
+    s.setValue("scaleMin", m_scaling.minimum);
+    s.setValue("scaleMax", m_scaling.maximum);
+
+    s.endGroup();
+    s.sync();
+
+    ProfileRegistry::instance()->saved(*this);
+}
+
+static const char * const s_formatNames[] = {
+    "keep",
+    "jpeg",
+    "png",
+    "webp"
+};
+
+QString Profile::formatName(OutputFormat f)
+{
+    return QLatin1String(s_formatNames[f]);
+}
+
+Profile::OutputFormat Profile::formatFromName(const QString &name, bool *ok)
+{
+    for (int i = KeepFormat; i <= WebPFormat; ++i)
+    {
+        if (name == QLatin1String(s_formatNames[i]))
+        {
+            if (ok)
+                *ok = true;
+            return OutputFormat(i);
+        }
+    }
+
+    if (ok)
+        *ok = false;
+    return KeepFormat;
+}
+
+static const char * const s_scaleModeNames[] = {
+    "native",
+    "width",
+    "height",
+    "shortEdge"
+};
+
+QString Profile::scaleModeName(ScaleMode m)
+{
+    return QLatin1String(s_scaleModeNames[m]);
+}
+
+Profile::ScaleMode Profile::scaleModeFromName(const QString &name, bool *ok)
+{
+    for (int i = NativeSize; i <= PercentOfShortEdge; ++i)
+    {
+        if (name == QLatin1String(s_scaleModeNames[i]))
+        {
+            if (ok)
+                *ok = true;
+            return ScaleMode(i);
+        }
+    }
+
+    if (ok)
+        *ok = false;
+    return NativeSize;
+}
+
+QString Profile::outputSuffix() const
+{
+    switch (m_outputFormat)
+    {
+    case Profile::KeepFormat:
+        break;
+    case Profile::JpegFormat:
+        return "jpg";
+    case Profile::PngFormat:
+        return "png";
+    case Profile::WebPFormat:
+        return "webp";
+    }
+
+    return QString();
+}
+
+void Profile::remove()
+{
+    QSettings s;
+    s.remove(m_name);
+    s.sync();
+
+    ProfileRegistry::instance()->removed(m_name);
+}
+
+void Profile::setLogoPath(const QString &p)
+{
+    if (p == m_watermarkImage)
+        return;
+
+    m_watermarkImage = p;
+    m_logoCache = QSharedPointer<LogoCache>(new LogoCache);
+}
+
+Profile::LogoCache *Profile::loadedLogo() const
+{
+    LogoCache *c = m_logoCache.data();
+    QMutexLocker locker(&c->mutex);
+
+    if (!c->loaded)
+    {
+        if (!QFileInfo(m_watermarkImage).exists())
+            qDebug() << "Logo file does not exist" << m_watermarkImage;
+        c->logo = QImage(m_watermarkImage);
+        c->premultiplied = c->logo.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        c->loaded = true;
+    }
+
+    return c;
+}
+
+QSize Profile::logoSize() const
+{
+    LogoCache *c = m_logoCache.data();
+    QMutexLocker locker(&c->mutex);
+
+    if (c->loaded)
+        return c->logo.size();
+    if (!c->probed)
+    {
+        c->size = ImageProbe::probe(m_watermarkImage).size;
+        c->probed = true;
+    }
+    return c->size;
+}
+
+QImage Profile::logo() const
+{
+    return loadedLogo()->logo;
+}
+
+QImage Profile::premultipliedLogo() const
+{
+    return loadedLogo()->premultiplied;
+}
+
+QString Profile::text() const
+{
+    return m_watermarkText;
+}
+
+qreal Profile::transparency() const
+{
+    return m_transparency;
+}
+
+QFont Profile::font() const
+{
+    return m_font;
+}
+
+QColor Profile::mainColor() const
+{
+    return m_mainColor;
+}
+
+QColor Profile::outlineColor() const
+{
+    return m_outlineColor;
+}
+
+QSize Profile::nativeSize() const
+{
+    switch (m_type)
+    {
+    case Profile::Image:
+        return logoSize();
+    case Profile::Text:
+    {
+        QFontMetrics fm(m_font);
+        return fm.boundingRect(0, 0, 0, 0, Qt::AlignLeft|Qt::AlignTop, m_watermarkText).size();
+    }
+    }
+
+    return QSize();
+}
+
+int Profile::scaleBucket(int w, int h) const
+{
+    return m_scaling.bucket(nativeSize(), w, h);
+}
+
+QSize Profile::size(int w, int h) const
+{
+    QSize native = nativeSize();
+    return Scaling::scaled(native, m_scaling.bucket(native, w, h));
+}
+
+QRect Profile::spriteRect(int w, int h) const
+{
+    return bucketSpriteRect(scaleBucket(w, h));
+}
+
+QRect Profile::bucketSpriteRect(int bucket) const
+{
+    switch (m_type)
+    {
+    case Profile::Image:
+        return QRect(QPoint(0, 0), Scaling::scaled(logoSize(), bucket));
+    case Profile::Text:
+    {
+        QPainterPath path = textPath(nativeSize());
+        if (path.isEmpty())
+            return QRect();
+        // room for the outline (and its square caps) around the glyphs
+        qreal margin = m_outlineSize + 1;
+        QRectF r = path.boundingRect().adjusted(-margin, -margin, margin, margin);
+        qreal f = Scaling::factor(bucket);
+        return QRectF(r.topLeft() * f, r.size() * f).toAlignedRect();
+    }
+    }
+
+    return QRect();
+}
+
+Profile::TextSprite Profile::textSprite(int w, int h) const
+{
+    return scaledTextSprite(scaleBucket(w, h));
+}
+
+Profile::TextSprite Profile::scaledTextSprite(int bucket) const
+{
+    QByteArray key = fingerprint() + '/' + QByteArray::number(bucket);
+
+    TextSpriteCache *c = textSpriteCache();
+    {
+        QMutexLocker locker(&c->mutex);
+        TextSprite *cached = c->cache.object(key);
+        if (cached)
+            return *cached;
+    }
+
+    // rendered unlocked; two threads racing for one key just do it twice
+    TextSprite sprite = renderTextSprite(bucket);
+
+    QMutexLocker locker(&c->mutex);
+    c->cache.insert(key, new TextSprite(sprite), sprite.cost());
+    return sprite;
+}
+
+QPainterPath Profile::textPath(const QSize &box) const
+{
+    QPainterPath path;
+    path.addText(0, box.height(), m_font, m_watermarkText);
+    return path;
+}
+
+Profile::TextSprite Profile::renderTextSprite(int bucket) const
+{
+    TextSprite sprite;
+    QSize native = nativeSize();
+    sprite.size = Scaling::scaled(native, bucket);
+
+    QPainterPath path = textPath(native);
+    if (path.isEmpty())
+        return sprite;
+    QRect r = bucketSpriteRect(bucket);
+    qreal f = Scaling::factor(bucket);
+
+    sprite.offset = r.topLeft();
+    sprite.image = QImage(r.size(), QImage::Format_ARGB32_Premultiplied);
+    sprite.image.fill(0);
+
+    QPainter painter(&sprite.image);
+    painter.translate(-r.topLeft());
+    // the outline pen scales along with the glyphs
+    painter.scale(f, f);
+    painter.setBrush(m_mainColor);
+    QPen pen(m_outlineColor);
+    pen.setWidth(m_outlineSize);
+    painter.setPen(pen);
+    painter.drawPath(path);
+    painter.end();
+
+    return sprite;
+}
+
+QByteArray Profile::fingerprint() const
+{
+    // the same fields operator!= compares
+    QStringList l;
+    l << QString::number(m_type)
+      << m_watermarkText
+      << QString::number(m_marginHorizontal)
+      << QString::number(m_marginVertical)
+      << m_watermarkImage
+      << m_font.toString()
+      << m_mainColor.name()
+      << m_outlineColor.name()
+      << QString::number(m_outlineSize)
+      << QString::number(m_transparency)
+      << QString::number(m_outputFormat)
+      << QString::number(m_quality)
+      << QString::number(m_pngCompression)
+      << QString::number(m_progressive)
+      << QString::number(m_optimizeHuffman)
+      << QString::number(m_metadataPolicy)
+      << QString::number(m_parallelPng)
+      << QString::number(m_scaling.mode)
+      << QString::number(m_scaling.percent)
+      << QString::number(m_scaling.minimum)
+      << QString::number(m_scaling.maximum);
+
+    return QCryptographicHash::hash(l.join(QChar(0x1f)).toUtf8(), QCryptographicHash::Sha1).toHex();
+}
+
+bool Profile::operator!=(const Profile &other) const
+{
+    return     this->type() != other.type()
+            || this->text() != other.text()
+            || this->marginHorizontal() != other.marginHorizontal()
+            || this->marginVertical() != other.marginVertical()
+            || this->logoPath() != other.logoPath()
+            || this->font() != other.font()
+            || this->mainColor() != other.mainColor()
+            || this->outlineColor() != other.outlineColor()
+            || this->outlineSize() != other.outlineSize()
+            || !qFuzzyCompare(this->transparency(), other.transparency())
+            || this->outputFormat() != other.outputFormat()
+            || this->quality() != other.quality()
+            || this->pngCompression() != other.pngCompression()
+            || this->progressive() != other.progressive()
+            || this->optimizeHuffman() != other.optimizeHuffman()
+            || this->metadataPolicy() != other.metadataPolicy()
+            || this->parallelPng() != other.parallelPng()
+            || this->scaling() != other.scaling();
+}
@@ -0,0 +1,231 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <QFont>
+#include <QString>
+#include <QColor>
+#include <QImage>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QPainterPath>
+
+
+class Profile
+{
+public:
+
+    enum WatermarkType {
+        Text,
+        Image
+    };
+
+    enum OutputFormat {
+        KeepFormat,
+        JpegFormat,
+        PngFormat,
+        WebPFormat
+    };
+
+    enum MetadataPolicy {
+        KeepMetadata,
+        StripMetadata
+    };
+
+    enum ScaleMode {
+        NativeSize,
+        PercentOfWidth,
+        PercentOfHeight,
+        // the longer side of the watermark relative to the shorter one of the image
+        PercentOfShortEdge
+    };
+
+    /* How large the watermark is on a given image. The factor relative
+     * to the native size (the logo's pixels or the text at the font's
+     * size) is quantized to buckets 1/16 of an octave (about 4.4 %)
+     * apart, so images of similar sizes share one scaled sprite.
+     * minimum and maximum clamp the measured side of the watermark in
+     * pixels, 0 is no clamp.
+     */
+    struct Scaling {
+        Scaling() : mode(NativeSize), percent(10), minimum(0), maximum(0) {}
+        ScaleMode mode;
+        qreal percent;
+        int minimum;
+        int maximum;
+
+        // 0 is the native size, also for images of an unknown (0 x 0) size
+        int bucket(const QSize &native, int w, int h) const;
+        static qreal factor(int bucket);
+        // at least 1 x 1, an empty size stays empty
+        static QSize scaled(const QSize &native, int bucket);
+        bool operator!=(const Scaling &other) const;
+    };
+
+    /* Text watermark rasterized once into a premultiplied ARGB image.
+     * offset is the position of the sprite relative to the top-left
+     * corner of the text box (the outline may stick out of it), size is
+     * the text box itself as returned by size().
+     */
+    struct TextSprite {
+        QImage image;
+        QPoint offset;
+        QSize size;
+
+        // the QCache cost, never 0
+        int cost() const
+        {
+#if QT_VERSION >= 0x050A00
+            return int(qMax(qsizetype(1), image.sizeInBytes()));
+#else
+            return qMax(1, image.byteCount());
+#endif
+        }
+    };
+
+    // reads the profile from the settings, see getProfile()
+    Profile(const QString &name="Default");
+
+    // cached by ProfileRegistry, no settings access
+    static QStringList getProfiles();
+    static Profile getProfile(const QString &name);
+
+    QString name() const { return m_name; }
+
+    bool operator!=(const Profile &other) const;
+    QByteArray fingerprint() const;
+
+    WatermarkType type() const { return m_type; }
+    void setType(WatermarkType t) { m_type = t; }
+
+    void save();
+    void remove();
+    bool isValid();
+
+    QImage logo() const;
+    QImage premultipliedLogo() const;
+
+    QString logoPath() const { return m_watermarkImage; }
+    void setLogoPath(const QString &p);
+
+    QString text() const;
+    void setText(const QString &t) { m_watermarkText = t; }
+
+    int marginVertical() const { return m_marginVertical; }
+    void setMarginVertical(int v) { m_marginVertical = v; }
+
+    int marginHorizontal() const { return m_marginHorizontal; }
+    void setMarginHorizontal(int v) { m_marginHorizontal = v; }
+
+    qreal transparency() const;
+    void setTransparency(qreal t) { m_transparency = t; }
+
+    QFont font() const;
+    void setFont(const QFont &f) { m_font = f; }
+
+    QColor mainColor() const;
+    void setMainColor(const QColor &c) { m_mainColor = c; }
+
+    QColor outlineColor() const;
+    void setOutlineColor(const QColor &c) { m_outlineColor = c; }
+
+    int outlineSize() const { return m_outlineSize; }
+    void setOutlineSize(int s) { m_outlineSize = s; }
+
+    // encoder settings for the watermarked files
+    OutputFormat outputFormat() const { return m_outputFormat; }
+    void setOutputFormat(OutputFormat f) { m_outputFormat = f; }
+    static QString formatName(OutputFormat f);
+    static OutputFormat formatFromName(const QString &name, bool *ok = 0);
+    // target file suffix, empty for KeepFormat
+    QString outputSuffix() const;
+
+    // JPEG and WebP, 0..100
+    int quality() const { return m_quality; }
+    void setQuality(int q) { m_quality = qBound(0, q, 100); }
+
+    // zlib level, 0..9
+    int pngCompression() const { return m_pngCompression; }
+    void setPngCompression(int c) { m_pngCompression = qBound(0, c, 9); }
+
+    bool progressive() const { return m_progressive; }
+    void setProgressive(bool p) { m_progressive = p; }
+
+    bool optimizeHuffman() const { return m_optimizeHuffman; }
+    void setOptimizeHuffman(bool o) { m_optimizeHuffman = o; }
+
+    MetadataPolicy metadataPolicy() const { return m_metadataPolicy; }
+    void setMetadataPolicy(MetadataPolicy m) { m_metadataPolicy = m; }
+
+    // deflate PNGs on all cores, see PngEncoder
+    bool parallelPng() const { return m_parallelPng; }
+    void setParallelPng(bool p) { m_parallelPng = p; }
+
+    Scaling scaling() const { return m_scaling; }
+    void setScaling(const Scaling &s) { m_scaling = s; }
+    static QString scaleModeName(ScaleMode m);
+    static ScaleMode scaleModeFromName(const QString &name, bool *ok = 0);
+    // the scale bucket of the watermark on a w x h image, see Scaling
+    int scaleBucket(int w, int h) const;
+
+    // from the logo's file header or the font metrics, nothing is decoded or rendered;
+    // scaled for a w x h image, the native size without one
+    QSize size(int w=0, int h=0) const;
+    // what the sprite covers relative to the placement point, cheap as size()
+    QRect spriteRect(int w=0, int h=0) const;
+    TextSprite textSprite(int w=0, int h=0) const;
+    // rendered at the scale of the bucket, the glyphs are scaled as paths, not pixels
+    TextSprite scaledTextSprite(int bucket) const;
+
+private:
+    QString m_name;
+    WatermarkType m_type;
+
+    QString m_watermarkText;
+    QString m_watermarkImage;
+
+    int m_marginVertical;
+    int m_marginHorizontal;
+
+    qreal m_transparency;
+
+    QFont m_font;
+    QColor m_mainColor;
+    QColor m_outlineColor;
+    int m_outlineSize;
+
+    OutputFormat m_outputFormat;
+    int m_quality;
+    int m_pngCompression;
+    bool m_progressive;
+    bool m_optimizeHuffman;
+    MetadataPolicy m_metadataPolicy;
+    bool m_parallelPng;
+
+    Scaling m_scaling;
+
+    /* Decoded logo, loaded on first use. The cache is shared by all
+     * copies of the profile (i.e. by all pool threads) and replaced,
+     * never modified, when the logo path changes.
+     */
+    struct LogoCache {
+        LogoCache() : loaded(false), probed(false) {}
+        QMutex mutex;
+        bool loaded;
+        bool probed;
+        QSize size;
+        QImage logo;
+        QImage premultiplied;
+    };
+    QSharedPointer<LogoCache> m_logoCache;
+
+    void load();
+    LogoCache *loadedLogo() const;
+    QSize logoSize() const;
+    QSize nativeSize() const;
+    QRect bucketSpriteRect(int bucket) const;
+    QPainterPath textPath(const QSize &box) const;
+    TextSprite renderTextSprite(int bucket) const;
+
+};
+
+#endif // PROFILE_H
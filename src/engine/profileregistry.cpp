@@ -0,0 +1,142 @@
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QMutexLocker>
+#include <QSettings>
+
+#include "profileregistry.h"
+
+
+static QMutex s_instanceMutex;
+static ProfileRegistry *s_instance = 0;
+
+
+ProfileRegistry *ProfileRegistry::instance()
+{
+    QMutexLocker locker(&s_instanceMutex);
+    if (!s_instance)
+    {
+        // goes away with the application, before QSettings does
+        s_instance = new ProfileRegistry(QCoreApplication::instance());
+        s_instance->reload();
+    }
+    return s_instance;
+}
+
+ProfileRegistry::ProfileRegistry(QObject *parent)
+    : QObject(parent),
+      m_watcher(new QFileSystemWatcher(this))
+{
+    connect(m_watcher, SIGNAL(fileChanged(QString)), this, SLOT(settingsFileChanged()));
+    watch();
+}
+
+ProfileRegistry::~ProfileRegistry()
+{
+    QMutexLocker locker(&s_instanceMutex);
+    if (s_instance == this)
+        s_instance = 0;
+}
+
+void ProfileRegistry::watch()
+{
+    // the native format may be the Windows registry, nothing to watch then
+    QString fname = QSettings().fileName();
+    if (QFileInfo(fname).exists() && !m_watcher->files().contains(fname))
+        m_watcher->addPath(fname);
+}
+
+QStringList ProfileRegistry::names() const
+{
+    QMutexLocker locker(&m_mutex);
+    QStringList l = m_profiles.keys();
+    if (!l.contains(QObject::tr("Default")))
+        l << QObject::tr("Default");
+    return l;
+}
+
+Profile ProfileRegistry::profile(const QString &name) const
+{
+    QMutexLocker locker(&m_mutex);
+    QMap<QString, Profile>::const_iterator it = m_profiles.constFind(name);
+    if (it != m_profiles.constEnd())
+        return it.value();
+
+    it = m_unsaved.constFind(name);
+    if (it != m_unsaved.constEnd())
+        return it.value();
+
+    // reads QSettings, keep it for the next preview or worker
+    Profile p(name);
+    m_unsaved.insert(name, p);
+    return p;
+}
+
+void ProfileRegistry::saved(const Profile &profile)
+{
+    m_mutex.lock();
+    m_profiles.insert(profile.name(), profile);
+    m_unsaved.remove(profile.name());
+    m_mutex.unlock();
+
+    // the first save may have created the settings file
+    watch();
+    emit changed();
+}
+
+void ProfileRegistry::removed(const QString &name)
+{
+    m_mutex.lock();
+    bool found = m_profiles.remove(name);
+    m_unsaved.remove(name);
+    m_mutex.unlock();
+
+    if (found)
+        emit changed();
+}
+
+void ProfileRegistry::reload()
+{
+    QSettings s;
+    // picks up what other processes wrote meanwhile
+    s.sync();
+
+    QMap<QString, Profile> profiles;
+    foreach (const QString &name, s.childGroups())
+    {
+        s.beginGroup(name);
+        bool isProfile = s.value("is_profile", false).toBool();
+        s.endGroup();
+        if (isProfile)
+            profiles.insert(name, Profile(name));
+    }
+
+    bool modified = false;
+    {
+        QMutexLocker locker(&m_mutex);
+        modified = profiles.keys() != m_profiles.keys();
+        QMap<QString, Profile>::iterator it;
+        for (it = profiles.begin(); it != profiles.end(); ++it)
+        {
+            QMap<QString, Profile>::const_iterator old = m_profiles.constFind(it.key());
+            // unchanged profiles keep their decoded logo
+            if (old != m_profiles.constEnd() && old.value().fingerprint() == it.value().fingerprint())
+                it.value() = old.value();
+            else
+                modified = true;
+        }
+        m_profiles = profiles;
+        // the defaults may have been written meanwhile
+        m_unsaved.clear();
+    }
+
+    if (modified)
+        emit changed();
+}
+
+void ProfileRegistry::settingsFileChanged()
+{
+    // replaced by rename, the watch was dropped with the old file
+    watch();
+    reload();
+}
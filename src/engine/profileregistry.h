@@ -0,0 +1,66 @@
+#ifndef PROFILEREGISTRY_H
+#define PROFILEREGISTRY_H
+
+#include <QMap>
+#include <QMutex>
+#include <QObject>
+#include <QStringList>
+
+#include "profile.h"
+
+class QFileSystemWatcher;
+
+
+/*! All saved profiles, read from QSettings once per process.
+ *
+ * profile() hands out copies of the loaded profiles; their members are
+ * implicitly shared and so is the decoded logo, so a copy per preview
+ * or per worker thread costs next to nothing. Profile::save() and
+ * Profile::remove() keep the registry up to date, edits of the settings
+ * file by other processes are picked up through a file system watcher.
+ *
+ * The registry is created on first use, which should happen in the
+ * main thread. Lookups are thread safe.
+ */
+class ProfileRegistry : public QObject
+{
+    Q_OBJECT
+
+public:
+    ~ProfileRegistry();
+
+    static ProfileRegistry *instance();
+
+    // saved profiles plus "Default", which always exists
+    QStringList names() const;
+    // a profile never saved gets its defaults, read once as well
+    Profile profile(const QString &name) const;
+
+    // called by Profile::save() and Profile::remove()
+    void saved(const Profile &profile);
+    void removed(const QString &name);
+
+public slots:
+    // re-reads all profiles from the settings
+    void reload();
+
+signals:
+    // a profile was added, removed or modified
+    void changed();
+
+private:
+    ProfileRegistry(QObject *parent);
+
+    mutable QMutex m_mutex;
+    QMap<QString, Profile> m_profiles;
+    // never saved ones handed out so far, "Default" mostly
+    mutable QMap<QString, Profile> m_unsaved;
+    QFileSystemWatcher *m_watcher;
+
+    void watch();
+
+private slots:
+    void settingsFileChanged();
+};
+
+#endif // PROFILEREGISTRY_H
@@ -0,0 +1,126 @@
+#include <QPainter>
+
+#include "renderplan.h"
+#include "blend.h"
+#include "jpegregion.h"
+
+
+RenderPlan::RenderPlan(const Profile &profile, WatermarkEngine::Position position)
+    : m_profile(profile),
+      m_scaling(profile.scaling()),
+      m_scaled(new Scaled),
+      m_position(position),
+      m_marginHorizontal(profile.marginHorizontal()),
+      m_marginVertical(profile.marginVertical()),
+      m_opacity(profile.transparency())
+{
+    switch (profile.type())
+    {
+    case Profile::Image:
+        m_sprite = profile.premultipliedLogo();
+        // placed by the decoded size, the header may have lied
+        m_size = m_sprite.size();
+        break;
+    case Profile::Text:
+    {
+        // the text box does not depend on the image size, nothing wraps
+        Profile::TextSprite sprite = profile.textSprite();
+        m_sprite = sprite.image;
+        m_size = sprite.size;
+        m_offset = sprite.offset;
+        break;
+    }
+    }
+}
+
+QImage RenderPlan::sprite(int w, int h, QPoint *pos) const
+{
+    int bucket = m_scaling.bucket(m_size, w, h);
+    if (bucket == 0)
+    {
+        *pos = WatermarkEngine::placement(w, h, m_size, m_marginHorizontal, m_marginVertical, m_position)
+               + m_offset;
+        return m_sprite;
+    }
+
+    qreal f = Profile::Scaling::factor(bucket);
+    Sprite s = scaled(bucket);
+    *pos = WatermarkEngine::placement(w, h, s.size, qRound(m_marginHorizontal * f), qRound(m_marginVertical * f),
+                                      m_position)
+           + s.offset;
+    return s.image;
+}
+
+RenderPlan::Sprite RenderPlan::scaled(int bucket) const
+{
+    {
+        QMutexLocker locker(&m_scaled->mutex);
+        Sprite *cached = m_scaled->cache.object(bucket);
+        if (cached)
+            return *cached;
+    }
+
+    // made unlocked; two threads racing for one bucket just do it twice
+    Sprite s;
+    switch (m_profile.type())
+    {
+    case Profile::Image:
+        s.size = Profile::Scaling::scaled(m_size, bucket);
+        if (!m_sprite.isNull())
+        {
+            // area averaging when shrinking, bilinear when growing
+            s.image = m_sprite.scaled(s.size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+        }
+        break;
+    case Profile::Text:
+        s = m_profile.scaledTextSprite(bucket);
+        break;
+    }
+
+    QMutexLocker locker(&m_scaled->mutex);
+    m_scaled->cache.insert(bucket, new Sprite(s), s.cost());
+    return s;
+}
+
+QRect RenderPlan::rect(int w, int h) const
+{
+    QPoint pos;
+    QSize size = sprite(w, h, &pos).size();
+    return QRect(pos, size) & QRect(0, 0, w, h);
+}
+
+void RenderPlan::paint(int w, int h, QPainter *painter) const
+{
+    QPoint pos;
+    QImage img = sprite(w, h, &pos);
+
+    painter->setOpacity(m_opacity);
+    painter->drawImage(pos, img);
+}
+
+bool RenderPlan::paint(QImage *image) const
+{
+    QPoint pos;
+    QImage img = sprite(image->width(), image->height(), &pos);
+
+    if (blendSprite(image, pos.x(), pos.y(), img, m_opacity))
+        return true;
+
+    QPainter painter;
+    if (!painter.begin(image))
+        return false;
+    painter.setOpacity(m_opacity);
+    painter.drawImage(pos, img);
+    painter.end();
+
+    return true;
+}
+
+bool RenderPlan::paint(JpegRegionEditor *jpeg) const
+{
+    QSize size = jpeg->size();
+    QPoint pos;
+    QImage img = sprite(size.width(), size.height(), &pos);
+
+    return jpeg->apply(img, pos, m_opacity);
+}
@@ -0,0 +1,83 @@
+#ifndef RENDERPLAN_H
+#define RENDERPLAN_H
+
+#include <QCache>
+#include <QImage>
+#include <QMutex>
+#include <QPoint>
+#include <QRect>
+#include <QSharedPointer>
+#include <QSize>
+
+#include "watermarkengine.h"
+
+class QPainter;
+class JpegRegionEditor;
+
+
+/*! What painting a profile's watermark at a position takes, worked
+ * out once per batch.
+ *
+ * The constructor decodes and premultiplies the logo or rasterizes the
+ * text with the profile's font, colors and outline pen, and copies the
+ * margins and the opacity. Per image only the placement arithmetic on
+ * the image size and the blit remain, without touching the profile, its
+ * caches or QSettings.
+ *
+ * A profile scaled relative to the image needs a sprite per scale
+ * bucket (see Profile::Scaling). Each is made the first time an image
+ * of that bucket comes along and kept for the rest of the batch: the
+ * logo is resampled smoothly from the native sprite, the text is
+ * rendered again from its glyph paths. The margins scale along. The
+ * buckets live behind a mutex, so the pool threads still share one
+ * plan through a const pointer.
+ */
+class RenderPlan
+{
+public:
+    RenderPlan(const Profile &profile, WatermarkEngine::Position position);
+
+    WatermarkEngine::Position position() const { return m_position; }
+    qreal opacity() const { return m_opacity; }
+
+    // the premultiplied sprite for a w x h image and its top-left corner there
+    QImage sprite(int w, int h, QPoint *pos) const;
+    // the part of a w x h image the watermark changes
+    QRect rect(int w, int h) const;
+
+    // through an arbitrary painter, e.g. a scaled preview
+    void paint(int w, int h, QPainter *painter) const;
+    // straight into the image, using the SIMD blend when the format allows
+    bool paint(QImage *image) const;
+    // into the DCT coefficients of a JPEG, see JpegRegionEditor
+    bool paint(JpegRegionEditor *jpeg) const;
+
+private:
+    typedef Profile::TextSprite Sprite;
+    struct Scaled {
+        // sprite bytes, the least recently used buckets go beyond it
+        Scaled() : cache(64 * 1024 * 1024) {}
+        QMutex mutex;
+        QCache<int, Sprite> cache;
+    };
+
+    // text is rendered again for each bucket
+    Profile m_profile;
+    Profile::Scaling m_scaling;
+    QSharedPointer<Scaled> m_scaled;
+
+    WatermarkEngine::Position m_position;
+    int m_marginHorizontal;
+    int m_marginVertical;
+    qreal m_opacity;
+
+    // the box the position and the margins apply to: the logo or the text box
+    QSize m_size;
+    QImage m_sprite;
+    // of the sprite relative to the box, the text outline may stick out of it
+    QPoint m_offset;
+
+    Sprite scaled(int bucket) const;
+};
+
+#endif // RENDERPLAN_H
@@ -0,0 +1,752 @@
+#include <QFile>
+#include <QFileInfo>
+#include <QVector>
+
+#include "rowstream.h"
+#include "profile.h"
+#include "pngencoder.h"
+
+#ifdef HAVE_LIBJPEG
+#include "jpegsupport.h"
+#endif
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include <limits.h>
+
+
+static QString suffixOf(const QString &fileName)
+{
+    return QFileInfo(fileName).suffix().toLower();
+}
+
+
+#ifdef HAVE_LIBJPEG
+
+// source manager reading the file in 64 KB pieces
+struct JpegFileSource
+{
+    jpeg_source_mgr pub;
+    QIODevice *device;
+    JOCTET buffer[64 * 1024];
+};
+
+static void initFileSource(j_decompress_ptr)
+{
+}
+
+static boolean fillFileBuffer(j_decompress_ptr cinfo)
+{
+    JpegFileSource *src = reinterpret_cast<JpegFileSource *>(cinfo->src);
+    qint64 n = src->device->read(reinterpret_cast<char *>(src->buffer), sizeof(src->buffer));
+    if (n <= 0)
+    {
+        // truncated file, pretend it ends properly as libjpeg's own managers do
+        src->buffer[0] = 0xFF;
+        src->buffer[1] = JPEG_EOI;
+        n = 2;
+    }
+    src->pub.next_input_byte = src->buffer;
+    src->pub.bytes_in_buffer = n;
+    return TRUE;
+}
+
+static void skipFileData(j_decompress_ptr cinfo, long n)
+{
+    if (n <= 0)
+        return;
+    while (size_t(n) > cinfo->src->bytes_in_buffer)
+    {
+        n -= long(cinfo->src->bytes_in_buffer);
+        fillFileBuffer(cinfo);
+    }
+    cinfo->src->next_input_byte += n;
+    cinfo->src->bytes_in_buffer -= n;
+}
+
+static void termFileSource(j_decompress_ptr)
+{
+}
+
+// destination manager writing 64 KB pieces to a device
+struct JpegDeviceDestination
+{
+    jpeg_destination_mgr pub;
+    QIODevice *device;
+    bool failed;
+    JOCTET buffer[64 * 1024];
+};
+
+static void initDeviceDestination(j_compress_ptr cinfo)
+{
+    JpegDeviceDestination *dest = reinterpret_cast<JpegDeviceDestination *>(cinfo->dest);
+    dest->pub.next_output_byte = dest->buffer;
+    dest->pub.free_in_buffer = sizeof(dest->buffer);
+}
+
+static boolean emptyDeviceBuffer(j_compress_ptr cinfo)
+{
+    JpegDeviceDestination *dest = reinterpret_cast<JpegDeviceDestination *>(cinfo->dest);
+    if (dest->device->write(reinterpret_cast<const char *>(dest->buffer), sizeof(dest->buffer)) != qint64(sizeof(dest->buffer)))
+        dest->failed = true;
+    dest->pub.next_output_byte = dest->buffer;
+    dest->pub.free_in_buffer = sizeof(dest->buffer);
+    return TRUE;
+}
+
+static void termDeviceDestination(j_compress_ptr cinfo)
+{
+    JpegDeviceDestination *dest = reinterpret_cast<JpegDeviceDestination *>(cinfo->dest);
+    qint64 n = sizeof(dest->buffer) - dest->pub.free_in_buffer;
+    if (dest->device->write(reinterpret_cast<const char *>(dest->buffer), n) != n)
+        dest->failed = true;
+}
+
+
+class JpegRowReader : public RowReader
+{
+public:
+    JpegRowReader(const QString &fileName)
+        : m_file(fileName),
+          m_created(false),
+          m_started(false)
+    {
+        jpegInitErrorManager(&m_err);
+        std::memset(&m_cinfo, 0, sizeof(m_cinfo));
+        m_cinfo.err = &m_err.pub;
+    }
+
+    ~JpegRowReader()
+    {
+        if (m_created)
+            jpeg_destroy_decompress(&m_cinfo);
+    }
+
+    bool open();
+    bool read(QImage *band);
+
+    j_decompress_ptr decompress() { return &m_cinfo; }
+
+private:
+    QFile m_file;
+    JpegErrorManager m_err;
+    jpeg_decompress_struct m_cinfo;
+    JpegFileSource m_src;
+    bool m_created;
+    bool m_started;
+    QByteArray m_line;
+
+    bool start();
+};
+
+bool JpegRowReader::open()
+{
+    if (!m_file.open(QIODevice::ReadOnly))
+    {
+        m_error = m_file.errorString();
+        return false;
+    }
+
+    if (!start())
+    {
+        m_error = QString::fromLatin1(m_err.message);
+        return false;
+    }
+
+    m_size = QSize(m_cinfo.output_width, m_cinfo.output_height);
+    m_line.resize(m_cinfo.output_width * 3);
+    return true;
+}
+
+bool JpegRowReader::start()
+{
+    if (setjmp(m_err.jump))
+        return false;
+
+    jpeg_create_decompress(&m_cinfo);
+    m_created = true;
+
+    m_src.pub.init_source = initFileSource;
+    m_src.pub.fill_input_buffer = fillFileBuffer;
+    m_src.pub.skip_input_data = skipFileData;
+    m_src.pub.resync_to_restart = jpeg_resync_to_restart;
+    m_src.pub.term_source = termFileSource;
+    m_src.pub.next_input_byte = 0;
+    m_src.pub.bytes_in_buffer = 0;
+    m_src.device = &m_file;
+    m_cinfo.src = &m_src.pub;
+
+    jpegSaveMarkers(&m_cinfo);
+    jpeg_read_header(&m_cinfo, TRUE);
+
+    // CMYK needs Adobe's inversion rules, leave it to Qt
+    if (m_cinfo.jpeg_color_space != JCS_GRAYSCALE
+            && m_cinfo.jpeg_color_space != JCS_YCbCr
+            && m_cinfo.jpeg_color_space != JCS_RGB)
+    {
+        std::strcpy(m_err.message, "unsupported JPEG color space");
+        return false;
+    }
+
+    m_cinfo.out_color_space = JCS_RGB;
+    jpeg_calc_output_dimensions(&m_cinfo);
+
+    /* A progressive (or otherwise multi-scan) file is buffered whole as
+     * coefficients by jpeg_start_decompress(), so only the output is
+     * streamed. The caller charges that before the first read() makes
+     * libjpeg allocate it.
+     */
+    if (jpeg_has_multiple_scans(&m_cinfo))
+        m_buffered = jpegCoefficientBytes(&m_cinfo);
+    return true;
+}
+
+bool JpegRowReader::read(QImage *band)
+{
+    Q_ASSERT(band->width() == m_size.width());
+
+    if (setjmp(m_err.jump))
+    {
+        m_error = QString::fromLatin1(m_err.message);
+        return false;
+    }
+
+    if (!m_started)
+    {
+        jpeg_start_decompress(&m_cinfo);
+        m_started = true;
+    }
+
+    JSAMPROW row = reinterpret_cast<JSAMPROW>(m_line.data());
+    for (int y = 0; y < band->height(); ++y)
+    {
+        if (jpeg_read_scanlines(&m_cinfo, &row, 1) != 1)
+        {
+            std::strcpy(m_err.message, "premature end of JPEG data");
+            longjmp(m_err.jump, 1);
+        }
+
+        QRgb *out = reinterpret_cast<QRgb *>(band->scanLine(y));
+        const uchar *in = row;
+        for (int x = 0; x < m_size.width(); ++x, in += 3)
+            out[x] = qRgb(in[0], in[1], in[2]);
+    }
+
+    return true;
+}
+
+
+class JpegRowWriter : public RowWriter
+{
+public:
+    JpegRowWriter(QIODevice *device, const Profile *profile, JpegRowReader *source)
+        : m_source(source),
+          m_quality(profile->quality()),
+          m_keepMetadata(profile->metadataPolicy() == Profile::KeepMetadata),
+          m_created(false)
+    {
+        jpegInitErrorManager(&m_err);
+        std::memset(&m_cinfo, 0, sizeof(m_cinfo));
+        m_cinfo.err = &m_err.pub;
+        m_dest.device = device;
+        m_dest.failed = false;
+    }
+
+    ~JpegRowWriter()
+    {
+        if (m_created)
+            jpeg_destroy_compress(&m_cinfo);
+    }
+
+    bool begin(const QSize &size, bool alpha);
+    bool write(const QImage &band);
+    bool finish();
+
+private:
+    JpegRowReader *m_source;
+    int m_quality;
+    bool m_keepMetadata;
+    JpegErrorManager m_err;
+    jpeg_compress_struct m_cinfo;
+    JpegDeviceDestination m_dest;
+    bool m_created;
+    QByteArray m_line;
+
+    bool start(const QSize &size);
+    bool checkDevice();
+};
+
+bool JpegRowWriter::begin(const QSize &size, bool)
+{
+    // alpha is dropped, as Qt's JPEG writer does
+    m_line.resize(size.width() * 3);
+    if (!start(size))
+    {
+        m_error = QString::fromLatin1(m_err.message);
+        return false;
+    }
+    return checkDevice();
+}
+
+bool JpegRowWriter::start(const QSize &size)
+{
+    if (setjmp(m_err.jump))
+        return false;
+
+    jpeg_create_compress(&m_cinfo);
+    m_created = true;
+
+    m_dest.pub.init_destination = initDeviceDestination;
+    m_dest.pub.empty_output_buffer = emptyDeviceBuffer;
+    m_dest.pub.term_destination = termDeviceDestination;
+    m_cinfo.dest = &m_dest.pub;
+
+    m_cinfo.image_width = size.width();
+    m_cinfo.image_height = size.height();
+    m_cinfo.input_components = 3;
+    m_cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&m_cinfo);
+    jpeg_set_quality(&m_cinfo, m_quality, TRUE);
+    // optimized tables and progressive scans would buffer the whole image
+    m_cinfo.optimize_coding = FALSE;
+
+    if (m_source)
+    {
+        j_decompress_ptr src = m_source->decompress();
+        m_cinfo.density_unit = src->density_unit;
+        m_cinfo.X_density = src->X_density;
+        m_cinfo.Y_density = src->Y_density;
+    }
+
+    jpeg_start_compress(&m_cinfo, TRUE);
+
+    if (m_source)
+        jpegCopyMarkers(m_source->decompress(), &m_cinfo, m_keepMetadata);
+
+    return true;
+}
+
+bool JpegRowWriter::write(const QImage &band)
+{
+    if (setjmp(m_err.jump))
+    {
+        m_error = QString::fromLatin1(m_err.message);
+        return false;
+    }
+
+    JSAMPROW row = reinterpret_cast<JSAMPROW>(m_line.data());
+    for (int y = 0; y < band.height(); ++y)
+    {
+        const QRgb *in = reinterpret_cast<const QRgb *>(band.constScanLine(y));
+        uchar *out = row;
+        for (int x = 0; x < band.width(); ++x)
+        {
+            *out++ = uchar(qRed(in[x]));
+            *out++ = uchar(qGreen(in[x]));
+            *out++ = uchar(qBlue(in[x]));
+        }
+        jpeg_write_scanlines(&m_cinfo, &row, 1);
+    }
+
+    return checkDevice();
+}
+
+bool JpegRowWriter::finish()
+{
+    if (setjmp(m_err.jump))
+    {
+        m_error = QString::fromLatin1(m_err.message);
+        return false;
+    }
+
+    jpeg_finish_compress(&m_cinfo);
+    return checkDevice();
+}
+
+bool JpegRowWriter::checkDevice()
+{
+    if (!m_dest.failed)
+        return true;
+    m_error = m_dest.device->errorString();
+    return false;
+}
+
+#endif // HAVE_LIBJPEG
+
+
+#ifdef HAVE_ZLIB
+
+/* Widest PNG streamed: a band of its rows is still a QImage Qt can
+ * allocate, and a row of any colour type fits an int with room to spare.
+ * Wider ones are crafted, not photographed.
+ */
+static const quint32 s_maxPngWidth = 1 << 22;
+
+static inline quint32 readUInt32(const uchar *p)
+{
+    return (quint32(p[0]) << 24) | (quint32(p[1]) << 16) | (quint32(p[2]) << 8) | p[3];
+}
+
+static inline uchar paethPredictor(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = qAbs(p - a);
+    int pb = qAbs(p - b);
+    int pc = qAbs(p - c);
+    if (pa <= pb && pa <= pc)
+        return uchar(a);
+    return uchar(pb <= pc ? b : c);
+}
+
+
+/*! 8 bit, non-interlaced PNG, any color type. The IDAT chunks are
+ * inflated one scanline at a time.
+ */
+class PngRowReader : public RowReader
+{
+public:
+    PngRowReader(const QString &fileName)
+        : m_file(fileName),
+          m_colorType(0),
+          m_channels(0),
+          m_hasKey(false),
+          m_idatLeft(0),
+          m_zinit(false),
+          m_first(true)
+    {
+    }
+
+    ~PngRowReader()
+    {
+        if (m_zinit)
+            inflateEnd(&m_zs);
+    }
+
+    bool open();
+    bool read(QImage *band);
+
+private:
+    QFile m_file;
+    int m_colorType;
+    int m_channels;
+    QVector<QRgb> m_palette;
+    bool m_hasKey;
+    int m_key[3];
+    quint32 m_idatLeft;
+    z_stream m_zs;
+    bool m_zinit;
+    QByteArray m_input;
+    QByteArray m_rows[2];
+    bool m_first;
+
+    bool readChunkHeader(quint32 *length, QByteArray *type);
+    bool inflateRow(uchar *out, int n);
+    void unfilter(uchar *row, const uchar *prev, int n);
+    bool fail(const QString &message);
+};
+
+bool PngRowReader::fail(const QString &message)
+{
+    m_error = message;
+    return false;
+}
+
+bool PngRowReader::readChunkHeader(quint32 *length, QByteArray *type)
+{
+    QByteArray h = m_file.read(8);
+    if (h.size() != 8)
+        return false;
+    *length = readUInt32(reinterpret_cast<const uchar *>(h.constData()));
+    *type = h.mid(4);
+    return true;
+}
+
+bool PngRowReader::open()
+{
+    if (!m_file.open(QIODevice::ReadOnly))
+        return fail(m_file.errorString());
+
+    if (m_file.read(8) != QByteArray("\x89PNG\r\n\x1a\n", 8))
+        return fail(QObject::tr("Not a PNG file"));
+
+    quint32 length;
+    QByteArray type;
+    while (readChunkHeader(&length, &type))
+    {
+        if (type == "IDAT")
+        {
+            if (m_size.isEmpty())
+                return fail(QObject::tr("Missing PNG header"));
+            m_idatLeft = length;
+            break;
+        }
+
+        QByteArray data = m_file.read(length);
+        m_file.read(4); // CRC
+        if (quint32(data.size()) != length)
+            return fail(QObject::tr("Truncated PNG file"));
+        const uchar *p = reinterpret_cast<const uchar *>(data.constData());
+
+        if (type == "IHDR" && length >= 13)
+        {
+            int depth = p[8];
+            m_colorType = p[9];
+            int interlace = p[12];
+            static const int channels[] = { 1, 0, 3, 1, 2, 0, 4 };
+            if (depth != 8 || interlace != 0 || m_colorType > 6 || !channels[m_colorType])
+                return fail(QObject::tr("Unsupported PNG layout"));
+            m_channels = channels[m_colorType];
+            const quint32 width = readUInt32(p);
+            const quint32 height = readUInt32(p + 4);
+            // the row buffers below are sized from it
+            if (width == 0 || height == 0 || width > s_maxPngWidth || height > INT_MAX)
+                return fail(QObject::tr("Invalid PNG image size"));
+            m_size = QSize(width, height);
+            m_alpha = m_colorType == 4 || m_colorType == 6;
+        }
+        else if (type == "PLTE")
+        {
+            for (quint32 i = 0; i + 2 < length; i += 3)
+                m_palette << qRgb(p[i], p[i + 1], p[i + 2]);
+        }
+        else if (type == "tRNS")
+        {
+            if (m_colorType == 3)
+            {
+                for (quint32 i = 0; i < length && int(i) < m_palette.size(); ++i)
+                    m_palette[i] = (m_palette.at(i) & 0x00ffffff) | (uint(p[i]) << 24);
+                m_alpha = true;
+            }
+            else if ((m_colorType == 0 && length >= 2) || (m_colorType == 2 && length >= 6))
+            {
+                for (int c = 0; c < (m_colorType == 0 ? 1 : 3); ++c)
+                    m_key[c] = (p[2 * c] << 8) | p[2 * c + 1];
+                m_hasKey = true;
+                m_alpha = true;
+            }
+        }
+    }
+
+    if (!m_idatLeft)
+        return fail(QObject::tr("Missing PNG image data"));
+    if (m_colorType == 3 && m_palette.isEmpty())
+        return fail(QObject::tr("Missing PNG palette"));
+
+    m_zs.zalloc = Z_NULL;
+    m_zs.zfree = Z_NULL;
+    m_zs.opaque = Z_NULL;
+    m_zs.next_in = Z_NULL;
+    m_zs.avail_in = 0;
+    if (inflateInit(&m_zs) != Z_OK)
+        return fail(QObject::tr("Cannot initialize zlib"));
+    m_zinit = true;
+
+    // bounded by s_maxPngWidth
+    const int n = int(qint64(m_size.width()) * m_channels + 1);
+    m_rows[0].resize(n);
+    m_rows[1].fill(0, n);
+    return true;
+}
+
+bool PngRowReader::inflateRow(uchar *out, int n)
+{
+    m_zs.next_out = out;
+    m_zs.avail_out = n;
+    while (m_zs.avail_out > 0)
+    {
+        if (m_zs.avail_in == 0)
+        {
+            // IDAT data may be split in any number of chunks
+            while (m_idatLeft == 0)
+            {
+                quint32 length;
+                QByteArray type;
+                m_file.read(4); // CRC
+                if (!readChunkHeader(&length, &type) || type != "IDAT")
+                    return fail(QObject::tr("Truncated PNG image data"));
+                m_idatLeft = length;
+            }
+            m_input = m_file.read(qMin<quint32>(m_idatLeft, 64 * 1024));
+            if (m_input.isEmpty())
+                return fail(QObject::tr("Truncated PNG image data"));
+            m_idatLeft -= m_input.size();
+            m_zs.next_in = reinterpret_cast<Bytef *>(m_input.data());
+            m_zs.avail_in = m_input.size();
+        }
+
+        int rc = inflate(&m_zs, Z_NO_FLUSH);
+        if (rc == Z_STREAM_END && m_zs.avail_out > 0)
+            return fail(QObject::tr("Truncated PNG image data"));
+        if (rc != Z_OK && rc != Z_STREAM_END)
+            return fail(QObject::tr("Corrupt PNG image data"));
+    }
+    return true;
+}
+
+void PngRowReader::unfilter(uchar *row, const uchar *prev, int n)
+{
+    const int bpp = m_channels;
+    const int type = row[0];
+    uchar *r = row + 1;
+    const uchar *p = prev + 1;
+    for (int i = 0; i < n; ++i)
+    {
+        int a = i >= bpp ? r[i - bpp] : 0;
+        int b = p[i];
+        int c = i >= bpp ? p[i - bpp] : 0;
+        switch (type)
+        {
+        case 1:
+            r[i] = uchar(r[i] + a);
+            break;
+        case 2:
+            r[i] = uchar(r[i] + b);
+            break;
+        case 3:
+            r[i] = uchar(r[i] + ((a + b) >> 1));
+            break;
+        case 4:
+            r[i] = uchar(r[i] + paethPredictor(a, b, c));
+            break;
+        }
+    }
+}
+
+bool PngRowReader::read(QImage *band)
+{
+    Q_ASSERT(band->width() == m_size.width());
+
+    const int n = m_size.width() * m_channels;
+    for (int y = 0; y < band->height(); ++y)
+    {
+        uchar *row = reinterpret_cast<uchar *>(m_rows[0].data());
+        if (!inflateRow(row, n + 1))
+            return false;
+        if (row[0] > 4)
+            return fail(QObject::tr("Corrupt PNG image data"));
+        // the row before the first one is all zeros
+        unfilter(row, reinterpret_cast<const uchar *>(m_rows[1].constData()), n);
+
+        QRgb *out = reinterpret_cast<QRgb *>(band->scanLine(y));
+        const uchar *in = row + 1;
+        for (int x = 0; x < m_size.width(); ++x, in += m_channels)
+        {
+            switch (m_colorType)
+            {
+            case 0:
+                out[x] = qRgb(in[0], in[0], in[0]);
+                if (m_hasKey && in[0] == m_key[0])
+                    out[x] = 0;
+                break;
+            case 2:
+                out[x] = qRgb(in[0], in[1], in[2]);
+                if (m_hasKey && in[0] == m_key[0] && in[1] == m_key[1] && in[2] == m_key[2])
+                    out[x] = 0;
+                break;
+            case 3:
+                out[x] = in[0] < m_palette.size() ? m_palette.at(in[0]) : qRgb(0, 0, 0);
+                break;
+            case 4:
+                out[x] = qRgba(in[0], in[0], in[0], in[1]);
+                break;
+            case 6:
+                out[x] = qRgba(in[0], in[1], in[2], in[3]);
+                break;
+            }
+        }
+
+        qSwap(m_rows[0], m_rows[1]);
+    }
+
+    return true;
+}
+
+
+class PngRowWriter : public RowWriter
+{
+public:
+    PngRowWriter(QIODevice *device, const Profile *profile)
+        : m_device(device)
+    {
+        m_encoder.setCompression(profile->pngCompression());
+    }
+
+    bool begin(const QSize &size, bool alpha)
+    {
+        return check(m_encoder.begin(size, alpha, m_device));
+    }
+
+    bool write(const QImage &band)
+    {
+        return check(m_encoder.writeRows(band));
+    }
+
+    bool finish()
+    {
+        return check(m_encoder.finish());
+    }
+
+private:
+    QIODevice *m_device;
+    PngEncoder m_encoder;
+
+    bool check(bool ok)
+    {
+        if (!ok)
+            m_error = m_encoder.errorString();
+        return ok;
+    }
+};
+
+#endif // HAVE_ZLIB
+
+
+RowReader *RowReader::create(const QString &fileName)
+{
+    QString suffix = suffixOf(fileName);
+#ifdef HAVE_LIBJPEG
+    if (suffix == "jpg" || suffix == "jpeg")
+        return new JpegRowReader(fileName);
+#endif
+#ifdef HAVE_ZLIB
+    if (suffix == "png")
+        return new PngRowReader(fileName);
+#endif
+    Q_UNUSED(suffix);
+    return 0;
+}
+
+bool RowWriter::canWrite(const QString &suffix)
+{
+    QString s = suffix.toLower();
+#ifdef HAVE_LIBJPEG
+    if (s == "jpg" || s == "jpeg")
+        return true;
+#endif
+#ifdef HAVE_ZLIB
+    if (s == "png")
+        return true;
+#endif
+    Q_UNUSED(s);
+    return false;
+}
+
+RowWriter *RowWriter::create(QIODevice *device, const QString &suffix, const Profile *profile, RowReader *source)
+{
+    QString s = suffix.toLower();
+#ifdef HAVE_LIBJPEG
+    if (s == "jpg" || s == "jpeg")
+        return new JpegRowWriter(device, profile, dynamic_cast<JpegRowReader *>(source));
+#endif
+#ifdef HAVE_ZLIB
+    if (s == "png")
+        return new PngRowWriter(device, profile);
+#endif
+    Q_UNUSED(s);
+    Q_UNUSED(device);
+    Q_UNUSED(profile);
+    Q_UNUSED(source);
+    return 0;
+}
@@ -0,0 +1,77 @@
+#ifndef ROWSTREAM_H
+#define ROWSTREAM_H
+
+#include <QImage>
+#include <QString>
+
+class QIODevice;
+class Profile;
+
+
+/*! Decodes an image a band of scanlines at a time.
+ *
+ * Used for images too large to decode whole: only one band is held in
+ * memory while the rows stream from the source to a RowWriter. JPEG
+ * (through libjpeg) and 8 bit non-interlaced PNG (through zlib) are
+ * supported; open() fails for anything else.
+ */
+class RowReader
+{
+public:
+    virtual ~RowReader() {}
+
+    // 0 if the format cannot be streamed in this build
+    static RowReader *create(const QString &fileName);
+
+    virtual bool open() = 0;
+
+    QSize size() const { return m_size; }
+    bool hasAlpha() const { return m_alpha; }
+    /* Memory the decoder holds for the whole image besides the band,
+     * e.g. the coefficients of a progressive JPEG; known after open().
+     */
+    qint64 bufferedBytes() const { return m_buffered; }
+
+    /* Fills band with the next band.height() rows; band must be RGB32,
+     * or ARGB32 when hasAlpha().
+     */
+    virtual bool read(QImage *band) = 0;
+
+    QString errorString() const { return m_error; }
+
+protected:
+    RowReader() : m_alpha(false), m_buffered(0) {}
+
+    QSize m_size;
+    bool m_alpha;
+    qint64 m_buffered;
+    QString m_error;
+};
+
+
+/*! Encodes an image a band of scanlines at a time, see RowReader.
+ */
+class RowWriter
+{
+public:
+    virtual ~RowWriter() {}
+
+    static bool canWrite(const QString &suffix);
+    /* 0 if the format cannot be streamed in this build. source, if it
+     * is a JPEG reader, lends its markers to a JPEG writer.
+     */
+    static RowWriter *create(QIODevice *device, const QString &suffix, const Profile *profile,
+                             RowReader *source = 0);
+
+    virtual bool begin(const QSize &size, bool alpha) = 0;
+    // band as returned by RowReader::read()
+    virtual bool write(const QImage &band) = 0;
+    virtual bool finish() = 0;
+
+    QString errorString() const { return m_error; }
+
+protected:
+    QString m_error;
+};
+
+#endif // ROWSTREAM_H
@@ -0,0 +1,1126 @@
+#include <QBuffer>
+#include <QDateTime>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QMutexLocker>
+#include <QPainter>
+#include <QRunnable>
+#include <QScopedPointer>
+#include <QSet>
+#include <QThread>
+#include <QWaitCondition>
+
+#include "watermarkengine.h"
+#include "blend.h"
+#include "fileutil.h"
+#include "jpegregion.h"
+#include "mappedfile.h"
+#include "pngencoder.h"
+#include "renderplan.h"
+#include "rowstream.h"
+
+
+/*! Runs one of the engine's stage loops in a pool thread.
+ */
+class StageWorker : public QRunnable
+{
+public:
+    typedef void (WatermarkEngine::*Loop)();
+
+    StageWorker(WatermarkEngine *engine, Loop loop)
+        : m_engine(engine),
+          m_loop(loop)
+    {
+    }
+
+    void run()
+    {
+        (m_engine->*m_loop)();
+    }
+
+private:
+    WatermarkEngine *m_engine;
+    Loop m_loop;
+};
+
+
+// header readers, enough to keep a network share busy
+static const int s_maxProbeThreads = 4;
+
+// rows per band when streaming large images
+static const int s_bandHeight = 64;
+
+// a band read plus the one written
+static qint64 streamCost(int width)
+{
+    return qint64(width) * s_bandHeight * 4 * 2;
+}
+
+// QThread::msleep() is protected in Qt 4
+static void backoff(int ms)
+{
+    QMutex mutex;
+    QWaitCondition never;
+    QMutexLocker locker(&mutex);
+    never.wait(&mutex, ms);
+}
+
+
+WatermarkEngine::WatermarkEngine(QObject *parent)
+    : QObject(parent),
+      m_position(UpperLeft),
+      m_recursive(false),
+      m_incremental(false),
+      m_jpegRegion(true),
+      m_largestFirst(true),
+      m_memoryBudget(0),
+      m_retries(2),
+      m_retryDelay(500),
+      m_maxErrors(0),
+      m_canceled(0),
+      m_running(false),
+      m_scanDone(false),
+      m_discovered(0),
+      m_pixels(0),
+      m_pixelsDone(0),
+      m_done(0),
+      m_skipped(0),
+      m_errors(0),
+      m_tooManyErrors(false),
+      m_admitted(0)
+{
+    setThreadCount(defaultThreadCount());
+}
+
+WatermarkEngine::~WatermarkEngine()
+{
+    cancel();
+    m_pool.waitForDone();
+}
+
+int WatermarkEngine::defaultThreadCount()
+{
+    return qMax(1, QThread::idealThreadCount());
+}
+
+static const char * const s_positionNames[] = {
+    "upper-left",
+    "upper-center",
+    "upper-right",
+    "center-left",
+    "center",
+    "center-right",
+    "lower-left",
+    "lower-center",
+    "lower-right"
+};
+
+QString WatermarkEngine::positionName(Position position)
+{
+    return QLatin1String(s_positionNames[position]);
+}
+
+WatermarkEngine::Position WatermarkEngine::positionFromName(const QString &name, bool *ok)
+{
+    for (int i = UpperLeft; i <= LowerRight; ++i)
+    {
+        if (name == QLatin1String(s_positionNames[i]))
+        {
+            if (ok)
+                *ok = true;
+            return Position(i);
+        }
+    }
+
+    if (ok)
+        *ok = false;
+    return UpperLeft;
+}
+
+void WatermarkEngine::setThreadCount(int c)
+{
+    if (c <= 0)
+        c = defaultThreadCount();
+
+    // decode and encode are the heavy stages, painting one logo is cheap
+    setDecodeThreads(c);
+    setCompositeThreads(qMax(1, c / 4));
+    setEncodeThreads(c);
+    setMaxInFlight(2 * c);
+}
+
+// lower case file suffixes of all formats Qt can read
+static QSet<QString> imageSuffixes()
+{
+    QSet<QString> suffixes;
+    foreach (QByteArray f, QImageReader::supportedImageFormats())
+        suffixes << QString::fromLatin1(f).toLower();
+    suffixes << "jpg" << "jpeg" << "tif" << "tiff";
+    return suffixes;
+}
+
+void WatermarkEngine::scanLoop()
+{
+    // cheap extension filter only, the content is sniffed by the decoders
+    const QSet<QString> suffixes = imageSuffixes();
+
+    QDir::Filters filters = QDir::NoDotAndDotDot | QDir::Readable | QDir::Files | QDir::AllDirs;
+    QDirIterator::IteratorFlags flags = m_recursive
+                                            ? QDirIterator::Subdirectories | QDirIterator::FollowSymlinks
+                                            : QDirIterator::NoIteratorFlags;
+    QDirIterator it(m_sourcePath, filters, flags);
+    while (it.hasNext() && !wasCanceled())
+    {
+        it.next();
+        if (!suffixes.contains(it.fileInfo().suffix().toLower()))
+            continue;
+
+        Item item;
+        item.source = it.filePath();
+        item.target = targetPath(item.source);
+        item.mtime = it.fileInfo().lastModified().toMSecsSinceEpoch();
+        item.size = it.fileInfo().size();
+
+        // done by an earlier, interrupted run of the same job, or unchanged
+        bool skip = m_completed.contains(item.source) || (m_incremental && isUpToDate(item, false));
+
+        if (skip)
+        {
+            // posted before fileDone(), as the probers do for the rest
+            QMetaObject::invokeMethod(this, "fileDiscovered", Qt::QueuedConnection,
+                                      Q_ARG(qint64, item.pixels()));
+            reportDone(item, QString(), true);
+            continue;
+        }
+
+        m_probeQueue.push(item);
+    }
+
+    m_probeQueue.close();
+}
+
+void WatermarkEngine::probeLoop()
+{
+    Item item;
+    while (m_probeQueue.pop(&item))
+    {
+        // a few header reads, the decoders are told the size before they start
+        if (!wasCanceled())
+            item.info = ImageProbe::probe(item.source);
+
+        // posted before the item is queued, so it always precedes its fileDone()
+        QMetaObject::invokeMethod(this, "fileDiscovered", Qt::QueuedConnection,
+                                  Q_ARG(qint64, item.pixels()));
+
+        item.queuedAt = m_stats.now();
+        m_decodeQueue.push(item);
+    }
+
+    // the last one out has seen every file found
+    if (!m_probersLeft.deref())
+    {
+        m_stats.setScanUsecs(m_stats.now());
+        m_decodeQueue.close();
+        QMetaObject::invokeMethod(this, "scanDone", Qt::QueuedConnection);
+    }
+}
+
+void WatermarkEngine::start()
+{
+    Q_ASSERT(!m_running);
+
+    m_stats.reset();
+    m_canceled = 0;
+    m_discovered = 0;
+    m_pixels = 0;
+    m_pixelsDone = 0;
+    m_done = 0;
+    m_skipped = 0;
+    m_errors = 0;
+    m_tooManyErrors = false;
+    m_scanDone = false;
+    m_running = true;
+
+    m_fingerprint = m_profile.fingerprint();
+    // the logo is decoded or the text rendered here, once for all workers
+    m_plan = QSharedPointer<const RenderPlan>(new RenderPlan(m_profile, m_position));
+    if (m_incremental)
+        m_manifest.load(m_destinationPath);
+
+    // the scan runs ahead of the decoders, queued paths are cheap
+    m_probeQueue.reset(0);
+    m_decodeQueue.reset(0);
+    m_decodeQueue.setOrder(m_largestFirst ? &WatermarkEngine::largerFirst : 0);
+    m_admitted = 0;
+    m_compositeQueue.reset(m_maxInFlight);
+    m_encodeQueue.reset(m_maxInFlight);
+
+    m_inFlight.acquire(m_inFlight.available());
+    m_inFlight.release(m_maxInFlight);
+    /* Freed pixel buffers kept for reuse count against the memory too:
+     * a fifth of it, which holds the largest image decoded whole (a
+     * quarter of what is left for the images), larger ones are streamed.
+     */
+    const qint64 memory = m_memoryBudget > 0 ? m_memoryBudget : MemoryBudget::defaultLimit();
+    m_images.setMaxCached(memory / 5);
+    m_budget.reset(memory - memory / 5);
+
+    m_dirsMutex.lock();
+    m_createdDirs.clear();
+    m_dirsMutex.unlock();
+
+    const int probeThreads = qMin(m_decodeThreads, s_maxProbeThreads);
+    m_probersLeft = probeThreads;
+    m_decodersLeft = m_decodeThreads;
+    m_compositorsLeft = m_compositeThreads;
+
+    emit started();
+
+    // every stage worker blocks on its queue, so all of them need a thread
+    m_pool.setMaxThreadCount(1 + probeThreads + m_decodeThreads + m_compositeThreads + m_encodeThreads);
+
+    m_pool.start(new StageWorker(this, &WatermarkEngine::scanLoop));
+    for (int i = 0; i < probeThreads; ++i)
+        m_pool.start(new StageWorker(this, &WatermarkEngine::probeLoop));
+    for (int i = 0; i < m_decodeThreads; ++i)
+        m_pool.start(new StageWorker(this, &WatermarkEngine::decodeLoop));
+    for (int i = 0; i < m_compositeThreads; ++i)
+        m_pool.start(new StageWorker(this, &WatermarkEngine::compositeLoop));
+    for (int i = 0; i < m_encodeThreads; ++i)
+        m_pool.start(new StageWorker(this, &WatermarkEngine::encodeLoop));
+}
+
+void WatermarkEngine::cancel()
+{
+    m_canceled = 1;
+}
+
+static bool isJpegName(const QString &fname)
+{
+    QString suffix = QFileInfo(fname).suffix().toLower();
+    return suffix == "jpg" || suffix == "jpeg";
+}
+
+/* Lets the decoders take an image only when its memory is available,
+ * see admit().
+ */
+struct WatermarkEngine::Admitter
+{
+    Admitter(WatermarkEngine *e) : engine(e) {}
+    BoundedQueue<Item>::Admission operator()(Item *item) const { return engine->admit(item); }
+    WatermarkEngine *engine;
+};
+
+bool WatermarkEngine::largerFirst(const Item &a, const Item &b)
+{
+    return a.pixels() > b.pixels();
+}
+
+bool WatermarkEngine::usesJpegRegion(const Item &item) const
+{
+    return m_jpegRegion && JpegRegionEditor::isAvailable()
+           && isJpegName(item.source) && isJpegName(item.target);
+}
+
+// what readImage() is going to take from the budget, as far as the header tells
+qint64 WatermarkEngine::admissionCost(const Item &item) const
+{
+    // deferred by readImage(), which knows better
+    if (item.need > 0)
+        return item.need;
+
+    const qint64 cost = item.info.decodedBytes();
+    const qint64 limit = m_budget.limit();
+
+    // the coefficients take 3 to 6 bytes a pixel, readImage() charges them exactly
+    if (usesJpegRegion(item) && cost <= limit)
+        return cost;
+    if (cost > limit / 4 && RowWriter::canWrite(QFileInfo(item.target).suffix()))
+        return streamCost(item.info.size.width());
+    return cost;
+}
+
+BoundedQueue<WatermarkEngine::Item>::Admission WatermarkEngine::admit(Item *item)
+{
+    // drained without decoding anything
+    if (wasCanceled())
+        return BoundedQueue<Item>::Take;
+
+    if (m_budget.tryAcquire(admissionCost(*item), &item->cost))
+    {
+        ++m_admitted;
+        return BoundedQueue<Item>::Take;
+    }
+
+    /* Smaller images may overtake one that does not fit yet, but not
+     * for ever, with a steady stream of them it would never fit.
+     */
+    if (item->deferredAt < 0)
+        item->deferredAt = m_admitted;
+    if (m_admitted - item->deferredAt > 2 * m_decodeThreads)
+        return BoundedQueue<Item>::Wait;
+    return BoundedQueue<Item>::Skip;
+}
+
+bool WatermarkEngine::holdBudget(Item *item, qint64 bytes)
+{
+    // admitted with the header's size; the decoder may know better
+    if (qBound(qint64(0), bytes, m_budget.limit()) == item->cost)
+        return true;
+
+    /* No waiting here: the decoder holds an in-flight slot, and images
+     * holding the memory may be waiting for one. When the bytes are not
+     * free the item goes back to the queue, to be admitted for them.
+     */
+    releaseBudget(item);
+    item->need = bytes;
+    return m_budget.tryAcquire(bytes, &item->cost);
+}
+
+void WatermarkEngine::releaseBudget(Item *item)
+{
+    if (!item->cost)
+        return;
+    m_budget.release(item->cost);
+    item->cost = 0;
+    // images passed over for lack of memory may fit now
+    m_decodeQueue.wake();
+}
+
+void WatermarkEngine::decodeLoop()
+{
+    Item item;
+    while (m_decodeQueue.pop(&item, Admitter(this)))
+    {
+        if (wasCanceled())
+        {
+            releaseBudget(&item);
+            reportDone(item);
+            continue;
+        }
+
+        // backpressure: wait until an encoder has released an image
+        m_inFlight.acquire();
+        item.stats.waitUsecs += m_stats.now() - item.queuedAt;
+
+        /* Let the kernel read ahead the file the next round of decoders
+         * will pick, so it is cached by the time it is mapped.
+         */
+        Item next;
+        if (m_decodeQueue.peek(m_decodeThreads - 1, &next))
+            MappedFile::prefetch(next.source);
+
+        emit fileStarted(item.source);
+
+        QElapsedTimer timer;
+        timer.start();
+        QString errorString;
+        ReadResult r = readImage(&item, &errorString);
+        item.stats.usecs[BatchStats::Decode] = timer.nsecsElapsed() / 1000;
+        if (r == ReadDeferred)
+        {
+            releaseItem(&item);
+            item.queuedAt = m_stats.now();
+            m_decodeQueue.requeue(item);
+            continue;
+        }
+        if (r != ReadOk)
+        {
+            releaseItem(&item);
+            reportDone(item, errorString, r == ReadUnchanged);
+            continue;
+        }
+
+        item.queuedAt = m_stats.now();
+        m_compositeQueue.push(item);
+        item.image = QImage();
+        item.jpeg.clear();
+        item.file.clear();
+        item.rows.clear();
+    }
+
+    if (!m_decodersLeft.deref())
+        m_compositeQueue.close();
+}
+
+int WatermarkEngine::retryDelay(int attempt) const
+{
+    // doubling, but never more than half a minute
+    return qMin(m_retryDelay << qMin(attempt, 16), 30000);
+}
+
+WatermarkEngine::ReadResult WatermarkEngine::readImage(Item *item, QString *errorString)
+{
+    // declared first, data and buffer below may point into its mapping
+    QSharedPointer<MappedFile> file(new MappedFile(item->source));
+    QByteArray data;
+    QBuffer buffer(&data);
+    QImageReader reader;
+
+    bool jpegRegion = usesJpegRegion(*item);
+
+    bool opened = file->open();
+    // transient failures, e.g. of a network share, are worth another try
+    for (int attempt = 0; !opened && attempt < m_retries && !wasCanceled(); ++attempt)
+    {
+        if (file->error() == QFile::NoError || file->error() == QFile::PermissionsError
+                || !QFile::exists(item->source))
+            break;
+        ++item->stats.retries;
+        backoff(retryDelay(attempt));
+        file = QSharedPointer<MappedFile>(new MappedFile(item->source));
+        opened = file->open();
+    }
+
+    // decode from the mapped file, no copy through QFile's buffers
+    if (opened)
+    {
+        data = file->data();
+
+        if (m_incremental)
+        {
+            item->hash = Manifest::hash(data);
+            if (isUpToDate(*item, true))
+            {
+                // touched but identical, just refresh the timestamps
+                recordDone(*item);
+                return ReadUnchanged;
+            }
+        }
+
+        buffer.open(QIODevice::ReadOnly);
+        reader.setDevice(&buffer);
+        // the suffix hint setFileName() would give
+        reader.setFormat(QFileInfo(item->source).suffix().toLower().toLatin1());
+    }
+    else if (file->error() != QFile::NoError || m_incremental || jpegRegion)
+    {
+        // only a file too large to map can be read another way, unless the bytes are needed
+        *errorString = tr("Cannot read the image '%1': %2").arg(item->source).arg(file->errorString());
+        return ReadFailed;
+    }
+    else
+        reader.setFileName(item->source);
+
+    // recorded as Ignored
+    if (!reader.canRead())
+        return ReadIgnored;
+
+    // the header tells what the decoded image costs
+    ImageProbe::Info info = item->info;
+    if (!info.isValid())
+        info.size = reader.size();
+    const QSize size = info.size;
+    const qint64 cost = info.decodedBytes();
+    const qint64 limit = m_budget.limit();
+
+    if (jpegRegion)
+    {
+        // the coefficients of all components, charged before libjpeg allocates them
+        QSharedPointer<JpegRegionEditor> jpeg(new JpegRegionEditor);
+        if (jpeg->readHeader(data) && jpeg->bufferedBytes() <= limit)
+        {
+            if (!holdBudget(item, jpeg->bufferedBytes()))
+                return ReadDeferred;
+            if (jpeg->readCoefficients())
+            {
+                item->jpeg = jpeg;
+                // the editor keeps referring to the mapped bytes
+                item->file = file;
+                return ReadOk;
+            }
+        }
+    }
+
+    // too large to share the budget with others, stream it band by band
+    if (cost > limit / 4 && RowWriter::canWrite(QFileInfo(item->target).suffix()))
+    {
+        QSharedPointer<RowReader> rows(RowReader::create(item->source));
+        if (rows && rows->open())
+        {
+            if (!holdBudget(item, streamCost(size.width()) + rows->bufferedBytes()))
+                return ReadDeferred;
+            item->rows = rows;
+            return ReadOk;
+        }
+    }
+
+    if (!holdBudget(item, cost))
+        return ReadDeferred;
+
+    // Qt's handlers decode straight into an image of the right size and format
+    QImage::Format format = reader.imageFormat();
+    if (size.isValid() && format != QImage::Format_Invalid)
+        item->image = m_images.image(size, format);
+
+    if (!reader.read(&item->image))
+    {
+        *errorString = tr("Cannot load the image '%1': %2").arg(item->source).arg(reader.errorString());
+        return ReadFailed;
+    }
+
+    return ReadOk;
+}
+
+void WatermarkEngine::releaseItem(Item *item)
+{
+    item->image = QImage();
+    item->jpeg.clear();
+    item->file.clear();
+    item->rows.clear();
+    releaseBudget(item);
+    m_inFlight.release();
+}
+
+bool WatermarkEngine::isUpToDate(const Item &item, bool byHash) const
+{
+    Manifest::Entry e;
+    if (!m_manifest.lookup(item.source, &e))
+        return false;
+
+    if (e.profile != m_fingerprint || e.position != m_position)
+        return false;
+
+    if (byHash ? e.hash != item.hash : (e.mtime != item.mtime || e.size != item.size))
+        return false;
+
+    return QFileInfo(item.target).exists();
+}
+
+void WatermarkEngine::recordDone(const Item &item)
+{
+    if (!m_incremental)
+        return;
+
+    Manifest::Entry e;
+    e.mtime = item.mtime;
+    e.size = item.size;
+    e.hash = item.hash;
+    e.profile = m_fingerprint;
+    e.position = m_position;
+    m_manifest.insert(item.source, e);
+}
+
+void WatermarkEngine::compositeLoop()
+{
+    QSharedPointer<const RenderPlan> plan = m_plan;
+
+    Item item;
+    while (m_compositeQueue.pop(&item))
+    {
+        item.stats.waitUsecs += m_stats.now() - item.queuedAt;
+        if (wasCanceled())
+        {
+            releaseItem(&item);
+            reportDone(item);
+            continue;
+        }
+
+        // streamed images are composited band by band by the encoder
+        if (item.rows)
+        {
+            item.queuedAt = m_stats.now();
+            m_encodeQueue.push(item);
+            item.rows.clear();
+            continue;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        // the placement, the sprite itself was prepared with the plan
+        QSize size = item.jpeg ? item.jpeg->size() : item.image.size();
+        QPoint pos;
+        plan->sprite(size.width(), size.height(), &pos);
+        item.stats.usecs[BatchStats::Prepare] = timer.nsecsElapsed() / 1000;
+
+        timer.restart();
+        if (item.jpeg && !plan->paint(item.jpeg.data()))
+        {
+            item.jpeg.clear();
+            // the coefficients may be half edited, start from the file again
+            if (!item.image.load(item.source))
+            {
+                releaseItem(&item);
+                reportDone(item, tr("Cannot load the image '%1'.").arg(item.source));
+                continue;
+            }
+        }
+
+        if (!item.jpeg && !plan->paint(&item.image))
+        {
+            releaseItem(&item);
+            reportDone(item, tr("Cannot paint the watermark on '%1'.").arg(item.source));
+            continue;
+        }
+        item.stats.usecs[BatchStats::Composite] = timer.nsecsElapsed() / 1000;
+
+        item.queuedAt = m_stats.now();
+        m_encodeQueue.push(item);
+        item.image = QImage();
+        item.jpeg.clear();
+        item.file.clear();
+    }
+
+    if (!m_compositorsLeft.deref())
+        m_encodeQueue.close();
+}
+
+void WatermarkEngine::encodeLoop()
+{
+    Profile profile = m_profile;
+    // reused for every image, grows to the largest output once
+    QByteArray buffer;
+    buffer.reserve(1 << 20);
+
+    Item item;
+    while (m_encodeQueue.pop(&item))
+    {
+        item.stats.waitUsecs += m_stats.now() - item.queuedAt;
+        if (wasCanceled())
+        {
+            releaseItem(&item);
+            reportDone(item);
+            continue;
+        }
+
+        QString errorString;
+        bool ok = writeTarget(&item, &profile, &buffer, &errorString);
+        releaseItem(&item);
+
+        if (ok)
+        {
+            item.stats.status = BatchStats::Written;
+            recordDone(item);
+            reportDone(item);
+        }
+        else if (wasCanceled())
+            reportDone(item);
+        else
+            reportDone(item, tr("An error occurred while saving the image '%1': %2").arg(item.target).arg(errorString));
+    }
+}
+
+bool WatermarkEngine::makeTargetDir(const QString &target)
+{
+    QString path = QFileInfo(target).absolutePath();
+
+    QMutexLocker locker(&m_dirsMutex);
+    if (m_createdDirs.contains(path))
+        return true;
+    if (!QDir().mkpath(path))
+        return false;
+    m_createdDirs.insert(path);
+    return true;
+}
+
+bool WatermarkEngine::writeTarget(Item *item, Profile *profile, QByteArray *buffer, QString *errorString)
+{
+    const QString suffix = QFileInfo(item->target).suffix();
+
+    // encode in memory, only streamed images are encoded straight into the file
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = true;
+    if (item->jpeg)
+    {
+        item->jpeg->setOptimized(profile->optimizeHuffman());
+        item->jpeg->setKeepMetadata(profile->metadataPolicy() == Profile::KeepMetadata);
+        if (profile->progressive())
+            item->jpeg->setProgressive(true);
+        ok = item->jpeg->write(buffer);
+        if (!ok)
+            *errorString = item->jpeg->errorString();
+    }
+    else if (!item->rows)
+    {
+        QBuffer device(buffer);
+        device.open(QIODevice::WriteOnly);
+        ok = encodeImage(item->image, &device, suffix, profile, errorString);
+    }
+    if (!ok)
+        return false;
+    item->stats.usecs[BatchStats::Encode] = timer.nsecsElapsed() / 1000;
+
+    timer.restart();
+    for (int attempt = 0; ; ++attempt)
+    {
+        ok = saveTarget(item, profile, *buffer, errorString);
+        // a streamed image cannot be read again
+        if (ok || item->rows || attempt >= m_retries || wasCanceled())
+            break;
+        ++item->stats.retries;
+        backoff(retryDelay(attempt));
+    }
+    buffer->resize(0);
+
+    item->stats.usecs[BatchStats::Write] = timer.nsecsElapsed() / 1000;
+    if (item->rows)
+        item->stats.usecs[BatchStats::Write] -= item->stats.usecs[BatchStats::Encode];
+    return ok;
+}
+
+bool WatermarkEngine::saveTarget(Item *item, Profile *profile, const QByteArray &data, QString *errorString)
+{
+    if (!makeTargetDir(item->target))
+    {
+        *errorString = tr("Cannot create the directory '%1'").arg(QFileInfo(item->target).absolutePath());
+        return false;
+    }
+
+    /* Written aside and renamed over the target: a cancel or a crash
+     * never leaves a partial image under the real name.
+     */
+    const QString tmpPath = item->target + ".part";
+    QFile f(tmpPath);
+    QIODevice::OpenMode mode = QIODevice::WriteOnly | QIODevice::Truncate;
+    if (!item->rows)
+        mode |= QIODevice::Unbuffered;
+    if (!f.open(mode))
+    {
+        *errorString = f.errorString();
+        return false;
+    }
+
+    bool ok = true;
+    if (item->rows)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        ok = streamImage(item->rows.data(), &f, QFileInfo(item->target).suffix(), profile, errorString);
+        // decoding, compositing and encoding are interleaved with the writes
+        item->stats.usecs[BatchStats::Encode] = timer.nsecsElapsed() / 1000;
+    }
+    else if (f.write(data) != data.size())
+    {
+        ok = false;
+        *errorString = f.errorString();
+    }
+
+    item->stats.bytesOut = f.size();
+    f.close();
+    if (ok && f.error() != QFile::NoError)
+    {
+        ok = false;
+        *errorString = f.errorString();
+    }
+    if (ok && !replaceFile(tmpPath, item->target))
+    {
+        ok = false;
+        *errorString = tr("Cannot replace '%1'").arg(item->target);
+    }
+    if (!ok)
+        QFile::remove(tmpPath);
+    return ok;
+}
+
+void WatermarkEngine::reportDone(const Item &item, const QString &errorMessage, bool skipped)
+{
+    BatchStats::Record r = item.stats;
+    r.source = item.source;
+    r.error = errorMessage;
+    r.bytesIn = item.size;
+    if (skipped)
+        r.status = BatchStats::Skipped;
+    else if (!errorMessage.isNull())
+        r.status = BatchStats::Failed;
+    m_stats.add(r);
+
+    QMetaObject::invokeMethod(this, "fileDone", Qt::QueuedConnection,
+                              Q_ARG(QString, item.source), Q_ARG(QString, errorMessage),
+                              Q_ARG(bool, skipped), Q_ARG(bool, r.status == BatchStats::Written),
+                              Q_ARG(qint64, item.pixels()));
+}
+
+void WatermarkEngine::fileDiscovered(qint64 pixels)
+{
+    ++m_discovered;
+    m_pixels += pixels;
+    emit discovered(m_discovered);
+}
+
+void WatermarkEngine::scanDone()
+{
+    m_scanDone = true;
+    emit scanFinished(m_discovered);
+    checkFinished();
+}
+
+void WatermarkEngine::fileDone(const QString &fname, const QString &errorMessage, bool skipped, bool written,
+                               qint64 pixels)
+{
+    ++m_done;
+    m_pixelsDone += pixels;
+    if (skipped)
+        ++m_skipped;
+
+    if (!errorMessage.isNull())
+    {
+        ++m_errors;
+        emit error(fname, errorMessage);
+
+        if (m_maxErrors > 0 && m_errors >= m_maxErrors && !wasCanceled())
+        {
+            m_tooManyErrors = true;
+            cancel();
+        }
+    }
+    if (written)
+        emit fileWritten(fname);
+
+    emit progress(m_done);
+    checkFinished();
+}
+
+int WatermarkEngine::progressPermille() const
+{
+    if (m_pixels > 0)
+        return int(m_pixelsDone * 1000 / m_pixels);
+    return m_discovered > 0 ? m_done * 1000 / m_discovered : 0;
+}
+
+int WatermarkEngine::secondsLeft() const
+{
+    if (!m_scanDone || m_pixelsDone <= 0 || m_pixelsDone >= m_pixels)
+        return -1;
+    // one 150 MP image takes about as long as 150 of 1 MP
+    double usecs = double(m_stats.now()) * (m_pixels - m_pixelsDone) / m_pixelsDone;
+    return int(usecs / 1000000);
+}
+
+void WatermarkEngine::checkFinished()
+{
+    if (!m_running || !m_scanDone || m_done < m_discovered)
+        return;
+
+    // after a cancel the finished images stay, unfinished ones only ever existed as .part files
+    if (m_incremental && !m_manifest.save())
+        emit error(m_destinationPath, tr("Cannot write the manifest in '%1'.").arg(m_destinationPath));
+    m_stats.finish();
+    // idle between batches, e.g. in the GUI, there is no reason to keep them
+    m_images.clear();
+    m_running = false;
+    emit finished();
+}
+
+QString WatermarkEngine::targetPath(const QString &fname) const
+{
+    QRegExp re("^" + m_sourcePath);
+    QString ret = fname;
+    ret.replace(re, m_destinationPath);
+
+    QString suffix = m_profile.outputSuffix();
+    if (!suffix.isEmpty())
+    {
+        QFileInfo fi(ret);
+        ret = fi.path() + '/' + fi.completeBaseName() + '.' + suffix;
+    }
+    return ret;
+}
+
+QPoint WatermarkEngine::placement(int w, int h, const QSize &size, const Profile *profile, Position position)
+{
+    // the margins scale along with the watermark
+    qreal f = Profile::Scaling::factor(profile->scaleBucket(w, h));
+    return placement(w, h, size, qRound(profile->marginHorizontal() * f), qRound(profile->marginVertical() * f),
+                     position);
+}
+
+QPoint WatermarkEngine::placement(int w, int h, const QSize &size, int marginHorizontal, int marginVertical,
+                                  Position position)
+{
+    int imageX = 0;
+    int imageY = 0;
+
+    //controls which logo position is selected
+    switch (position)
+    {
+    case UpperLeft:
+        //Do nothing, is default already set
+        break;
+    case UpperCenter:
+        imageX = w/2 - size.width()/2;
+        imageY = 0 + marginVertical;
+        break;
+    case UpperRight:
+        imageX = w - size.width() - marginHorizontal;
+        imageY = 0 + marginVertical;
+        break;
+    case CenterLeft:
+        imageX = 0 + marginHorizontal;
+        imageY = h/2 - size.height()/2;
+        break;
+    case Center:
+        imageX = w/2 - size.width()/2;
+        imageY = h/2 - size.height()/2;
+        break;
+    case CenterRight:
+        imageX = w - size.width() - marginHorizontal;
+        imageY = h/2 - size.height()/2;
+        break;
+    case LowerLeft:
+        imageX = 0 + marginHorizontal;
+        imageY = h - size.height() - marginVertical;
+        break;
+    case LowerCenter:
+        imageX = w/2 - size.width()/2;
+        imageY = h - size.height() - marginVertical;
+        break;
+    case LowerRight:
+        imageX = w - size.width() - marginHorizontal;
+        imageY = h - size.height() - marginVertical;
+        break;
+    }
+
+    return QPoint(imageX, imageY);
+}
+
+QRect WatermarkEngine::watermarkRect(int w, int h, const Profile *profile, Position position)
+{
+    QPoint pos = placement(w, h, profile->size(w, h), profile, position);
+    return profile->spriteRect(w, h).translated(pos) & QRect(0, 0, w, h);
+}
+
+void WatermarkEngine::paintOne(int w, int h, QPainter *painter, Profile *profile, Position position)
+{
+    RenderPlan(*profile, position).paint(w, h, painter);
+}
+
+bool WatermarkEngine::paintOne(QImage *image, Profile *profile, Position position)
+{
+    return RenderPlan(*profile, position).paint(image);
+}
+
+bool WatermarkEngine::encodeImage(const QImage &image, QIODevice *device, const QString &suffix,
+                                  const Profile *profile, QString *errorString)
+{
+    QByteArray format = suffix.toLower().toLatin1();
+
+    // the handlers write the text keys the reader found, drop them from a shallow copy
+    QImage out = image;
+    if (profile->metadataPolicy() == Profile::StripMetadata && !image.textKeys().isEmpty())
+    {
+        out = QImage(image.constBits(), image.width(), image.height(), image.bytesPerLine(), image.format());
+        out.setColorTable(image.colorTable());
+        out.setDotsPerMeterX(image.dotsPerMeterX());
+        out.setDotsPerMeterY(image.dotsPerMeterY());
+#if QT_VERSION >= 0x050E00
+        // not metadata to strip, the colours depend on it
+        out.setColorSpace(image.colorSpace());
+#endif
+    }
+
+    if (format == "png" && profile->parallelPng() && PngEncoder::isAvailable())
+    {
+        PngEncoder png;
+        png.setCompression(profile->pngCompression());
+        if (png.write(out, device))
+            return true;
+        *errorString = png.errorString();
+        return false;
+    }
+
+    QImageWriter writer(device, format);
+    if (format == "png")
+    {
+        // Qt maps the quality to the zlib level as (100 - quality) * 9 / 91
+        writer.setQuality(100 - (profile->pngCompression() * 91 + 8) / 9);
+    }
+    else
+        writer.setQuality(profile->quality());
+#if QT_VERSION >= 0x050500
+    writer.setProgressiveScanWrite(profile->progressive());
+    writer.setOptimizedWrite(profile->optimizeHuffman());
+#endif
+
+    if (!writer.write(out))
+    {
+        *errorString = writer.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool WatermarkEngine::streamImage(RowReader *reader, QIODevice *device, const QString &suffix,
+                                  Profile *profile, QString *errorString)
+{
+    QScopedPointer<RowWriter> writer(RowWriter::create(device, suffix, profile, reader));
+    if (!writer)
+    {
+        *errorString = tr("Cannot stream into '%1' files").arg(suffix);
+        return false;
+    }
+
+    const QSize size = reader->size();
+    const bool alpha = reader->hasAlpha();
+    if (!writer->begin(size, alpha))
+    {
+        *errorString = writer->errorString();
+        return false;
+    }
+
+    QPoint pos;
+    QImage img = m_plan->sprite(size.width(), size.height(), &pos);
+
+    QImage band = m_images.image(QSize(size.width(), s_bandHeight),
+                                 alpha ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+    for (int y = 0; y < size.height(); y += band.height())
+    {
+        if (wasCanceled())
+        {
+            *errorString = tr("Canceled");
+            return false;
+        }
+
+        if (size.height() - y < band.height())
+            band = m_images.image(QSize(size.width(), size.height() - y), band.format());
+
+        if (!reader->read(&band))
+        {
+            *errorString = reader->errorString();
+            return false;
+        }
+
+        // only the bands under the watermark are composited, the rest just passes through
+        if (y < pos.y() + img.height() && y + band.height() > pos.y())
+        {
+            // opaque bands are painted in place, a second reference would detach them
+            QImage premultiplied;
+            QImage *target = &band;
+            if (alpha)
+            {
+                premultiplied = band.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+                target = &premultiplied;
+            }
+            if (!blendSprite(target, pos.x(), pos.y() - y, img, m_plan->opacity()))
+            {
+                QPainter painter(target);
+                painter.setOpacity(m_plan->opacity());
+                painter.drawImage(QPoint(pos.x(), pos.y() - y), img);
+            }
+            if (alpha)
+                band = premultiplied.convertToFormat(QImage::Format_ARGB32);
+        }
+
+        if (!writer->write(band))
+        {
+            *errorString = writer->errorString();
+            return false;
+        }
+    }
+
+    if (!writer->finish())
+    {
+        *errorString = writer->errorString();
+        return false;
+    }
+    return true;
+}
+
+bool WatermarkEngine::paintOne(JpegRegionEditor *jpeg, Profile *profile, Position position)
+{
+    return RenderPlan(*profile, position).paint(jpeg);
+}
@@ -0,0 +1,332 @@
+#ifndef WATERMARKENGINE_H
+#define WATERMARKENGINE_H
+
+#include <QObject>
+#include <QMutex>
+#include <QSet>
+#include <QStringList>
+#include <QThreadPool>
+#include <QAtomicInt>
+#include <QSemaphore>
+#include <QImage>
+#include <QSharedPointer>
+
+#include "profile.h"
+#include "boundedqueue.h"
+#include "manifest.h"
+#include "memorybudget.h"
+#include "batchstats.h"
+#include "imageprobe.h"
+#include "imagepool.h"
+
+class QIODevice;
+class QPainter;
+class JpegRegionEditor;
+class MappedFile;
+class RowReader;
+class RenderPlan;
+
+
+/*! Batch watermarking engine.
+ *
+ * Files flow through a pipeline running in the engine's own thread
+ * pool: a scanner walks the source folder and queues candidate files
+ * as it finds them, decoders sniff and load the source image,
+ * compositors call paintOne() and encoders save the result. Stages are connected with
+ * bounded queues and the number of decoded images alive at any time is
+ * capped by maxInFlight(), so a slow disk stalls the decoders instead
+ * of filling the memory.
+ *
+ * A few probers read the size of every image found from its header,
+ * in parallel so a slow share does not hold up the scan. The
+ * decoders take the largest images first, so a huge one found last
+ * does not leave all but one core idle at the end of the batch, and
+ * only start an image once its pixels fit into the memory budget;
+ * smaller ones overtake it meanwhile, but only for a while.
+ *
+ * The engine itself lives in the thread that created it (usually the
+ * GUI one) and all signals are delivered there through queued
+ * connections.
+ */
+class WatermarkEngine : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    enum Position {
+        UpperLeft,
+        UpperCenter,
+        UpperRight,
+        CenterLeft,
+        Center,
+        CenterRight,
+        LowerLeft,
+        LowerCenter,
+        LowerRight
+    };
+
+    WatermarkEngine(QObject *parent = 0);
+    ~WatermarkEngine();
+
+    static int defaultThreadCount();
+
+    static QString positionName(Position position);
+    static Position positionFromName(const QString &name, bool *ok = 0);
+
+    static QPoint placement(int w, int h, const QSize &size, const Profile *profile, Position position);
+    static QPoint placement(int w, int h, const QSize &size, int marginHorizontal, int marginVertical,
+                            Position position);
+    /* The part of a w x h image paintOne() changes, known from the image
+     * and logo headers alone, i.e. before anything is decoded.
+     */
+    static QRect watermarkRect(int w, int h, const Profile *profile, Position position);
+
+    // one-off painting, every call makes a RenderPlan; a batch or a preview keeps one
+
+    // paint through an arbitrary painter
+    static void paintOne(int w, int h, QPainter *painter, Profile *profile, Position position);
+    // paint straight into the image, using the SIMD blend when the format allows
+    static bool paintOne(QImage *image, Profile *profile, Position position);
+    // paint into the DCT coefficients of a JPEG, see JpegRegionEditor
+    static bool paintOne(JpegRegionEditor *jpeg, Profile *profile, Position position);
+
+    // writes image in the format given by suffix with the profile's encoder settings
+    static bool encodeImage(const QImage &image, QIODevice *device, const QString &suffix,
+                            const Profile *profile, QString *errorString);
+
+    void setProfile(const Profile &p) { m_profile = p; }
+    void setPosition(Position p) { m_position = p; }
+
+    void setSourcePath(const QString &p) { m_sourcePath = p; }
+    void setDestinationPath(const QString &p) { m_destinationPath = p; }
+    void setRecursive(bool r) { m_recursive = r; }
+
+    // skip sources the destination manifest lists as already done
+    bool incremental() const { return m_incremental; }
+    void setIncremental(bool i) { m_incremental = i; }
+
+    // JPEG to JPEG re-encodes only the blocks under the watermark
+    bool jpegRegion() const { return m_jpegRegion; }
+    void setJpegRegion(bool j) { m_jpegRegion = j; }
+
+    /* Bytes of decoded images held at once, 0 for MemoryBudget's
+     * default. A fifth of it keeps freed pixel buffers for reuse, see
+     * ImagePool. Images larger than a fifth are streamed band by band
+     * when their source and target formats allow it; a progressive JPEG
+     * then still holds its coefficients, which are charged to it.
+     */
+    qint64 memoryBudget() const { return m_memoryBudget; }
+    void setMemoryBudget(qint64 bytes) { m_memoryBudget = qMax(qint64(0), bytes); }
+
+    // decode the largest images first rather than in directory order
+    bool largestFirst() const { return m_largestFirst; }
+    void setLargestFirst(bool l) { m_largestFirst = l; }
+
+    /* Failed reads and writes are tried again this many times, the
+     * delay in milliseconds doubles with every attempt. Streamed images
+     * cannot be written again and fail at once.
+     */
+    int retries() const { return m_retries; }
+    void setRetries(int r) { m_retries = qMax(0, r); }
+    int retryDelay() const { return m_retryDelay; }
+    void setRetryDelay(int ms) { m_retryDelay = qMax(0, ms); }
+
+    // the batch is canceled after this many failed images, 0 never cancels
+    int maxErrors() const { return m_maxErrors; }
+    void setMaxErrors(int c) { m_maxErrors = qMax(0, c); }
+
+    /* Sources to skip as already done, e.g. by an interrupted run of
+     * the same BatchJob. Reported as skipped.
+     */
+    void setCompletedFiles(const QSet<QString> &sources) { m_completed = sources; }
+
+    // sets all stage sizes derived from one overall thread count
+    void setThreadCount(int c);
+
+    int decodeThreads() const { return m_decodeThreads; }
+    void setDecodeThreads(int c) { m_decodeThreads = qMax(1, c); }
+
+    int compositeThreads() const { return m_compositeThreads; }
+    void setCompositeThreads(int c) { m_compositeThreads = qMax(1, c); }
+
+    int encodeThreads() const { return m_encodeThreads; }
+    void setEncodeThreads(int c) { m_encodeThreads = qMax(1, c); }
+
+    int maxInFlight() const { return m_maxInFlight; }
+    void setMaxInFlight(int c) { m_maxInFlight = qMax(1, c); }
+
+    QString targetPath(const QString &fname) const;
+
+    bool isRunning() const { return m_running; }
+    int discoveredCount() const { return m_discovered; }
+    // pixels of the images found and of those done, skipped ones weigh nothing
+    qint64 discoveredPixels() const { return m_pixels; }
+    qint64 donePixels() const { return m_pixelsDone; }
+    // 0..1000 by pixels, by files while no sizes are known
+    int progressPermille() const;
+    // from the pixel rate so far, -1 while the scan runs or nothing is done yet
+    int secondsLeft() const;
+    int doneCount() const { return m_done; }
+    int skippedCount() const { return m_skipped; }
+    int errorCount() const { return m_errors; }
+    // canceled by maxErrors() rather than by cancel()
+    bool tooManyErrors() const { return m_tooManyErrors; }
+    // per file and per stage timing of the last batch
+    const BatchStats &stats() const { return m_stats; }
+    bool wasCanceled() const { return m_canceled != 0; }
+
+    void start();
+
+public slots:
+    void cancel();
+
+signals:
+    void started();
+    // running count of files found by the scanner
+    void discovered(int count);
+    void scanFinished(int total);
+    void progress(int done);
+    void fileStarted(const QString &fname);
+    // fname's watermarked copy is complete on disk
+    void fileWritten(const QString &fname);
+    void error(const QString &fname, const QString &message);
+    void finished();
+
+private:
+    struct Item {
+        Item() : mtime(0), size(0), cost(0), need(0), queuedAt(0), deferredAt(-1) {}
+        // the weight for scheduling and progress
+        qint64 pixels() const { return info.isValid() ? qint64(info.size.width()) * info.size.height() : 0; }
+        QString source;
+        QString target;
+        qint64 mtime;
+        qint64 size;
+        QByteArray hash;
+        // from the file header, invalid when it could not be read
+        ImageProbe::Info info;
+        QImage image;
+        // set instead of image on the JPEG fast path
+        QSharedPointer<JpegRegionEditor> jpeg;
+        // source mapping the jpeg editor reads from
+        QSharedPointer<MappedFile> file;
+        // set instead of image for streamed images
+        QSharedPointer<RowReader> rows;
+        // taken from m_budget
+        qint64 cost;
+        // what readImage() found it needs, 0 until it looked
+        qint64 need;
+        // filled in as the item moves through the stages
+        BatchStats::Record stats;
+        // m_stats clock when last queued
+        qint64 queuedAt;
+        // m_admitted when first passed over for lack of memory
+        int deferredAt;
+    };
+    struct Admitter;
+    friend struct Admitter;
+
+    Profile m_profile;
+    Position m_position;
+
+    QString m_sourcePath;
+    QString m_destinationPath;
+    bool m_recursive;
+    bool m_incremental;
+    bool m_jpegRegion;
+    bool m_largestFirst;
+    qint64 m_memoryBudget;
+    int m_retries;
+    int m_retryDelay;
+    int m_maxErrors;
+    QSet<QString> m_completed;
+
+    Manifest m_manifest;
+    QByteArray m_fingerprint;
+    // made by start() from m_profile and m_position, shared by the workers
+    QSharedPointer<const RenderPlan> m_plan;
+
+    int m_decodeThreads;
+    int m_compositeThreads;
+    int m_encodeThreads;
+    int m_maxInFlight;
+
+    QThreadPool m_pool;
+    QAtomicInt m_canceled;
+    bool m_running;
+    bool m_scanDone;
+
+    int m_discovered;
+    qint64 m_pixels;
+    qint64 m_pixelsDone;
+    int m_done;
+    int m_skipped;
+    int m_errors;
+    bool m_tooManyErrors;
+
+    // found by the scanner, not probed yet
+    BoundedQueue<Item> m_probeQueue;
+    BoundedQueue<Item> m_decodeQueue;
+    BoundedQueue<Item> m_compositeQueue;
+    BoundedQueue<Item> m_encodeQueue;
+    QSemaphore m_inFlight;
+    MemoryBudget m_budget;
+    // pixel buffers of the decoded images and stream bands
+    ImagePool m_images;
+    BatchStats m_stats;
+    // images the decoders took, only used with m_decodeQueue locked
+    int m_admitted;
+    QAtomicInt m_probersLeft;
+    QAtomicInt m_decodersLeft;
+    QAtomicInt m_compositorsLeft;
+
+    // target directories known to exist, so mkpath runs once per directory
+    QSet<QString> m_createdDirs;
+    QMutex m_dirsMutex;
+
+
+    void scanLoop();
+    void probeLoop();
+    void decodeLoop();
+    void compositeLoop();
+    void encodeLoop();
+    enum ReadResult {
+        ReadOk,
+        ReadUnchanged,
+        // not an image, silently skipped
+        ReadIgnored,
+        ReadFailed,
+        // needs more memory than is free now, queue it again
+        ReadDeferred
+    };
+
+    static bool largerFirst(const Item &a, const Item &b);
+    bool usesJpegRegion(const Item &item) const;
+    qint64 admissionCost(const Item &item) const;
+    BoundedQueue<Item>::Admission admit(Item *item);
+    bool holdBudget(Item *item, qint64 bytes);
+    void releaseBudget(Item *item);
+
+    int retryDelay(int attempt) const;
+    ReadResult readImage(Item *item, QString *errorString);
+    void releaseItem(Item *item);
+    bool makeTargetDir(const QString &target);
+    bool writeTarget(Item *item, Profile *profile, QByteArray *buffer, QString *errorString);
+    // one attempt at writing the encoded image
+    bool saveTarget(Item *item, Profile *profile, const QByteArray &data, QString *errorString);
+    bool streamImage(RowReader *reader, QIODevice *device, const QString &suffix,
+                     Profile *profile, QString *errorString);
+    bool isUpToDate(const Item &item, bool byHash) const;
+    void recordDone(const Item &item);
+    void reportDone(const Item &item, const QString &errorMessage = QString(), bool skipped = false);
+
+    void checkFinished();
+
+private slots:
+    void fileDiscovered(qint64 pixels);
+    void scanDone();
+    void fileDone(const QString &fname, const QString &errorMessage, bool skipped, bool written,
+                  qint64 pixels);
+};
+
+#endif // WATERMARKENGINE_H
@@ -0,0 +1,27 @@
+TEMPLATE = app
+TARGET = QWatermark 
+
+QT        += core gui 
+
+ENGINE_BUILD_DIR = $$OUT_PWD/engine
+include(engine/engine.pri)
+
+HEADERS   += qwatermark.h \
+    profiledialog.h \
+    previewrenderer.h
+SOURCES   += main.cpp \
+    qwatermark.cpp \
+    profiledialog.cpp \
+    previewrenderer.cpp
+FORMS     += qwatermark.ui \     
+    profiledialog.ui
+RESOURCES += \
+    resources.qrc
+
+mac {
+    # Copy the custom Info.plist to the app bundle
+    QMAKE_INFO_PLIST = Info.plist
+
+    # Icon is mandatory for submission
+    ICON = qwatermark.icns
+}
@@ -0,0 +1,130 @@
+#include <QImageReader>
+#include <QPainter>
+#include <QRunnable>
+
+#include "previewrenderer.h"
+#include "renderplan.h"
+
+
+class PreviewTask : public QRunnable
+{
+public:
+    PreviewTask(PreviewRenderer *renderer, const PreviewRenderer::Request &request, int generation)
+        : m_renderer(renderer),
+          m_request(request),
+          m_generation(generation)
+    {
+    }
+
+    void run()
+    {
+        QImage img = m_renderer->paint(m_request, m_generation);
+        QMetaObject::invokeMethod(m_renderer, "renderDone", Qt::QueuedConnection,
+                                  Q_ARG(QImage, img), Q_ARG(int, m_generation));
+    }
+
+private:
+    PreviewRenderer *m_renderer;
+    PreviewRenderer::Request m_request;
+    int m_generation;
+};
+
+
+PreviewRenderer::PreviewRenderer(QObject *parent)
+    : QObject(parent),
+      m_generation(0),
+      m_busy(false),
+      m_hasPending(false),
+      m_baseZoom(0)
+{
+    m_pool.setMaxThreadCount(1);
+}
+
+PreviewRenderer::~PreviewRenderer()
+{
+    m_generation.ref();
+    m_pool.waitForDone();
+}
+
+void PreviewRenderer::render(const QString &path, int zoom, const Profile &profile, WatermarkEngine::Position position)
+{
+    m_pending.path = path;
+    m_pending.zoom = zoom;
+    m_pending.profile = profile;
+    m_pending.position = position;
+    m_hasPending = true;
+
+    // whatever is running now is out of date
+    m_generation.ref();
+
+    if (!m_busy)
+        startPending();
+}
+
+void PreviewRenderer::startPending()
+{
+    m_busy = true;
+    m_hasPending = false;
+    m_pool.start(new PreviewTask(this, m_pending, m_generation));
+}
+
+void PreviewRenderer::renderDone(const QImage &image, int generation)
+{
+    m_busy = false;
+
+    if (!isStale(generation) && !image.isNull())
+        emit rendered(image);
+
+    if (m_hasPending)
+        startPending();
+}
+
+QImage PreviewRenderer::paint(const Request &request, int generation)
+{
+    Profile profile = request.profile;
+    if (isStale(generation) || !profile.isValid())
+        return QImage();
+
+    if (!loadBase(request.path, request.zoom) || isStale(generation))
+        return QImage();
+
+    // the logo is decoded or the text rendered once, not for every frame
+    QByteArray fingerprint = profile.fingerprint();
+    if (!m_plan || fingerprint != m_planFingerprint || m_plan->position() != request.position)
+    {
+        m_plan = QSharedPointer<const RenderPlan>(new RenderPlan(profile, request.position));
+        m_planFingerprint = fingerprint;
+    }
+
+    // paint in the full size coordinates so the preview matches the output
+    QImage img = m_base;
+    QPainter p(&img);
+    p.setRenderHint(QPainter::SmoothPixmapTransform);
+    p.scale(qreal(img.width()) / m_fullSize.width(),
+            qreal(img.height()) / m_fullSize.height());
+    m_plan->paint(m_fullSize.width(), m_fullSize.height(), &p);
+    p.end();
+
+    return isStale(generation) ? QImage() : img;
+}
+
+bool PreviewRenderer::loadBase(const QString &path, int zoom)
+{
+    if (!m_base.isNull() && path == m_basePath && zoom == m_baseZoom)
+        return true;
+
+    QImageReader reader(path);
+    m_fullSize = reader.size();
+    if (!m_fullSize.isValid())
+        return false;
+
+    QSize scaled = m_fullSize;
+    scaled.scale(QSize(m_fullSize.width(), qMax(1, qRound(m_fullSize.height() / 100.0 * zoom))),
+                 Qt::KeepAspectRatio);
+    reader.setScaledSize(scaled);
+
+    m_base = reader.read();
+    m_basePath = path;
+    m_baseZoom = zoom;
+    return !m_base.isNull();
+}
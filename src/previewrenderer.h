@@ -0,0 +1,72 @@
+#ifndef PREVIEWRENDERER_H
+#define PREVIEWRENDERER_H
+
+#include <QObject>
+#include <QImage>
+#include <QThreadPool>
+#include <QAtomicInt>
+#include <QSharedPointer>
+
+#include "profile.h"
+#include "watermarkengine.h"
+
+class RenderPlan;
+
+/*! Renders watermark previews in a background thread.
+ *
+ * Requests are coalesced: render() only remembers the latest state and
+ * bumps a generation counter, so a render still running for an older
+ * state gives up at its next check and its result is dropped. At most
+ * one render runs at a time and only the newest image is emitted.
+ *
+ * The background is decoded at the display size (the decoder scales,
+ * JPEG even in the DCT) and cached until the zoom or the path change;
+ * later requests only repaint the watermark over it. The watermark's
+ * RenderPlan is kept too, until the profile or the position change.
+ */
+class PreviewRenderer : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Request {
+        QString path;
+        int zoom;
+        Profile profile;
+        WatermarkEngine::Position position;
+    };
+
+    PreviewRenderer(QObject *parent = 0);
+    ~PreviewRenderer();
+
+    void render(const QString &path, int zoom, const Profile &profile, WatermarkEngine::Position position);
+
+    bool isStale(int generation) const { return m_generation != generation; }
+    QImage paint(const Request &request, int generation);
+
+signals:
+    void rendered(const QImage &image);
+
+private:
+    QThreadPool m_pool;
+    QAtomicInt m_generation;
+    bool m_busy;
+    bool m_hasPending;
+    Request m_pending;
+
+    // only touched from the (single) pool thread
+    QString m_basePath;
+    int m_baseZoom;
+    QImage m_base;
+    QSize m_fullSize;
+    QSharedPointer<const RenderPlan> m_plan;
+    QByteArray m_planFingerprint;
+
+    void startPending();
+    bool loadBase(const QString &path, int zoom);
+
+private slots:
+    void renderDone(const QImage &image, int generation);
+};
+
+#endif // PREVIEWRENDERER_H
@@ -8,6 +8,8 @@
 #include "profiledialog.h"
 #include "ui_profiledialog.h"
 #include "profile.h"
+#include "previewrenderer.h"
+#include "pngencoder.h"
 
 
 ProfileDialog::ProfileDialog(const QString &name, QWidget *parent) :
@@ -15,6 +17,9 @@ ProfileDialog::ProfileDialog(const QString &name, QWidget *parent) :
 {
     setupUi(this);
 
+    m_previewRenderer = new PreviewRenderer(this);
+    connect(m_previewRenderer, SIGNAL(rendered(QImage)), this, SLOT(previewRendered(QImage)));
+
     QSettings s;
     s.beginGroup("ProfileDialog");
     restoreGeometry(s.value("geometry").toByteArray());
@@ -30,6 +35,15 @@ ProfileDialog::ProfileDialog(const QString &name, QWidget *parent) :
     connect(verticalSpinBox, SIGNAL(valueChanged(int)),
             this, SLOT(verticalSpinBox_valueChanged(int)));
 
+    connect(scaleComboBox, SIGNAL(currentIndexChanged(int)),
+            this, SLOT(scale_changed()));
+    connect(scaleSpinBox, SIGNAL(valueChanged(double)),
+            this, SLOT(scale_changed()));
+    connect(scaleMinSpinBox, SIGNAL(valueChanged(int)),
+            this, SLOT(scale_changed()));
+    connect(scaleMaxSpinBox, SIGNAL(valueChanged(int)),
+            this, SLOT(scale_changed()));
+
     connect(watermarkPushButton, SIGNAL(clicked()),
             this, SLOT(selectLogo(void)));
     connect(textColorButton,SIGNAL(clicked()),
@@ -60,6 +74,22 @@ ProfileDialog::ProfileDialog(const QString &name, QWidget *parent) :
     connect(underlineToolButton, SIGNAL(clicked()),
             this, SLOT(font_changed()));
 
+    parallelPngCheckBox->setEnabled(PngEncoder::isAvailable());
+    connect(outputFormatComboBox, SIGNAL(currentIndexChanged(int)),
+            this, SLOT(output_changed()));
+    connect(metadataComboBox, SIGNAL(currentIndexChanged(int)),
+            this, SLOT(output_changed()));
+    connect(qualitySpinBox, SIGNAL(valueChanged(int)),
+            this, SLOT(output_changed()));
+    connect(pngCompressionSpinBox, SIGNAL(valueChanged(int)),
+            this, SLOT(output_changed()));
+    connect(progressiveCheckBox, SIGNAL(toggled(bool)),
+            this, SLOT(output_changed()));
+    connect(optimizeCheckBox, SIGNAL(toggled(bool)),
+            this, SLOT(output_changed()));
+    connect(parallelPngCheckBox, SIGNAL(toggled(bool)),
+            this, SLOT(output_changed()));
+
     connect(listWidget, SIGNAL(currentItemChanged(QListWidgetItem*,QListWidgetItem*)),
             this, SLOT(currentItemChanged(QListWidgetItem*,QListWidgetItem*)));
     connect(addButton, SIGNAL(clicked()), this, SLOT(addButton_clicked()));
@@ -129,6 +159,38 @@ void ProfileDialog::loadProfile(const QString &name)
 
     setButtonColor(m_profile.mainColor(), textColorButton);
     setButtonColor(m_profile.outlineColor(), outlineColorButton);
+
+    // output_changed() fires while the widgets are set, read from a copy;
+    // the combo indexes follow the enums
+    Profile p = m_profile;
+    outputFormatComboBox->setCurrentIndex(p.outputFormat());
+    metadataComboBox->setCurrentIndex(p.metadataPolicy());
+    qualitySpinBox->setValue(p.quality());
+    pngCompressionSpinBox->setValue(p.pngCompression());
+    progressiveCheckBox->setChecked(p.progressive());
+    optimizeCheckBox->setChecked(p.optimizeHuffman());
+    parallelPngCheckBox->setChecked(p.parallelPng());
+    output_changed();
+
+    Profile::Scaling scaling = p.scaling();
+    scaleComboBox->setCurrentIndex(scaling.mode);
+    scaleSpinBox->setValue(scaling.percent);
+    scaleMinSpinBox->setValue(scaling.minimum);
+    scaleMaxSpinBox->setValue(scaling.maximum);
+    scale_changed();
+
+    updatePreview();
+}
+
+void ProfileDialog::updatePreview()
+{
+    // renders in the background, a burst of edits is coalesced there
+    m_previewRenderer->render(":/preview.jpg", 20, m_profile, WatermarkEngine::Center);
+}
+
+void ProfileDialog::previewRendered(const QImage &image)
+{
+    previewLabel->setPixmap(QPixmap::fromImage(image));
 }
 
 //Select the image to use to watermark
@@ -142,6 +204,8 @@ void ProfileDialog::selectLogo(void)
         watermarkLineEdit->setText(logoFile);
         m_profile.setLogoPath(logoFile);
     }
+
+    updatePreview();
 }
 
 //Switch between image and text watermarking
@@ -157,6 +221,8 @@ void ProfileDialog::imageTextChange(void)
         typeStackedWidget->setCurrentIndex(1);
         m_profile.setType(Profile::Image);
     }
+
+    updatePreview();
 }
 
 void ProfileDialog::setButtonColor(const QColor &c, QPushButton *b)
@@ -173,6 +239,8 @@ void ProfileDialog::textColorButton_clicked(void)
     QColor c = QColorDialog::getColor(m_profile.mainColor(), this);
     setButtonColor(c, textColorButton);
     m_profile.setMainColor(c);
+
+    updatePreview();
 }
 
 void ProfileDialog::outlineColorButton_clicked(void)
@@ -180,31 +248,43 @@ void ProfileDialog::outlineColorButton_clicked(void)
     QColor c = QColorDialog::getColor(m_profile.outlineColor(), this);
     setButtonColor(c, outlineColorButton);
     m_profile.setOutlineColor(c);
+
+    updatePreview();
 }
 
 void ProfileDialog::outlineSpinBox_valueChanged(int v)
 {
     m_profile.setOutlineSize(v);
+
+    updatePreview();
 }
 
 void ProfileDialog::transparency_valueChanged(int value)
 {
     m_profile.setTransparency(value / 100.0);
+
+    updatePreview();
 }
 
 void ProfileDialog::plainTextEdit_textChanged()
 {
     m_profile.setText(plainTextEdit->toPlainText());
+
+    updatePreview();
 }
 
 void ProfileDialog::horizontalSpinBox_valueChanged(int v)
 {
     m_profile.setMarginHorizontal(v);
+
+    updatePreview();
 }
 
 void ProfileDialog::verticalSpinBox_valueChanged(int v)
 {
     m_profile.setMarginVertical(v);
+
+    updatePreview();
 }
 
 void ProfileDialog::font_changed()
@@ -222,6 +302,36 @@ void ProfileDialog::font_changed()
     f.setPointSize(sizeSpinBox->value());
 
     m_profile.setFont(f);
+
+    updatePreview();
+}
+
+void ProfileDialog::output_changed()
+{
+    m_profile.setOutputFormat(Profile::OutputFormat(outputFormatComboBox->currentIndex()));
+    m_profile.setMetadataPolicy(Profile::MetadataPolicy(metadataComboBox->currentIndex()));
+    m_profile.setQuality(qualitySpinBox->value());
+    m_profile.setPngCompression(pngCompressionSpinBox->value());
+    m_profile.setProgressive(progressiveCheckBox->isChecked());
+    m_profile.setOptimizeHuffman(optimizeCheckBox->isChecked());
+    m_profile.setParallelPng(parallelPngCheckBox->isChecked());
+}
+
+void ProfileDialog::scale_changed()
+{
+    Profile::Scaling scaling;
+    scaling.mode = Profile::ScaleMode(scaleComboBox->currentIndex());
+    scaling.percent = scaleSpinBox->value();
+    scaling.minimum = scaleMinSpinBox->value();
+    scaling.maximum = scaleMaxSpinBox->value();
+    m_profile.setScaling(scaling);
+
+    bool relative = scaling.mode != Profile::NativeSize;
+    scaleSpinBox->setEnabled(relative);
+    scaleMinSpinBox->setEnabled(relative);
+    scaleMaxSpinBox->setEnabled(relative);
+
+    updatePreview();
 }
 
 void ProfileDialog::currentItemChanged(QListWidgetItem * current, QListWidgetItem * previous)
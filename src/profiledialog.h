@@ -5,6 +5,7 @@
 #include "ui_profiledialog.h"
 #include "profile.h"
 
+class PreviewRenderer;
 
 class ProfileDialog : public QDialog, public Ui::ProfileDialog
 {
@@ -16,6 +17,7 @@ public:
     
 private:
     Profile m_profile;
+    PreviewRenderer *m_previewRenderer;
 
     void setButtonColor(const QColor &c, QPushButton *b);
     void closeEvent(QCloseEvent *event);
@@ -36,6 +38,11 @@ private slots:
     void transparency_valueChanged(int value);
     void plainTextEdit_textChanged();
     void font_changed();
+    void output_changed();
+    void scale_changed();
+
+    void updatePreview();
+    void previewRendered(const QImage &image);
 
     void accept();
 
@@ -1,23 +1,34 @@
 #include "QDebug"
 #include <QProgressDialog>
-#include <QDirIterator>
-#include <QImageReader>
+#include <QEventLoop>
 #include <QCompleter>
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QPainter>
 #include <QSettings>
+#include <QTimer>
 
 #include "qwatermark.h"
 #include "profile.h"
+#include "profileregistry.h"
 #include "profiledialog.h"
+#include "previewrenderer.h"
 
 
 QWatermark::QWatermark(QWidget *parent)
-    : QMainWindow(parent)
+    : QMainWindow(parent),
+      m_progress(0),
+      m_errCnt(0),
+      m_previewPath(":/preview.jpg")
 {
     setupUi(this);
 
+    m_engine = new WatermarkEngine(this);
+    connect(m_engine, SIGNAL(error(QString,QString)), this, SLOT(watermarkError(QString,QString)));
+
+    m_previewRenderer = new PreviewRenderer(this);
+    connect(m_previewRenderer, SIGNAL(rendered(QImage)), this, SLOT(previewRendered(QImage)));
+
     QCompleter *completer = new QCompleter(this);
     FSModel *fsModel = new FSModel(completer);
     fsModel->setRootPath("");
@@ -33,6 +44,9 @@ QWatermark::QWatermark(QWidget *parent)
     destinationLineEdit->setText(s.value("destinationPath").toString());
     previewZoomSpinBox->setValue(s.value("zoom", 30).toInt());
     treeCheckBox->setChecked(s.value("treeIteration", false).toBool());
+    incrementalCheckBox->setChecked(s.value("incremental", false).toBool());
+    threadsSpinBox->setMaximum(qMax(64, WatermarkEngine::defaultThreadCount()));
+    threadsSpinBox->setValue(s.value("threads", WatermarkEngine::defaultThreadCount()).toInt());
 
     int ix = profileComboBox->findText(s.value("profile", tr("Default")).toString());
     if (ix > -1)
@@ -58,14 +72,18 @@ QWatermark::QWatermark(QWidget *parent)
     connect(destinationLineEdit, SIGNAL(textEdited(QString)), this, SLOT(checkConditions()));
 
     connect(buttonGroup, SIGNAL(buttonClicked(int)), this, SLOT(preview()));
-    connect(profileComboBox, SIGNAL(currentIndexChanged(int)), this, SLOT(preview()));
+    connect(profileComboBox, SIGNAL(currentIndexChanged(int)), this, SLOT(profileChanged()));
+    connect(ProfileRegistry::instance(), SIGNAL(changed()), this, SLOT(profilesChanged()));
     connect(previewZoomSpinBox, SIGNAL(valueChanged(int)), this, SLOT(preview()));
 
     connect(editProfileButton, SIGNAL(clicked()), this, SLOT(editProfileButton_clicked()));
 
     checkConditions();
 
-    preview();
+    profileChanged();
+
+    // once the window is up, offer to finish what a crash or an abort left
+    QTimer::singleShot(0, this, SLOT(resumeJobs()));
 }
 
 void QWatermark::closeEvent(QCloseEvent *event)
@@ -80,6 +98,8 @@ void QWatermark::closeEvent(QCloseEvent *event)
     s.setValue("zoom", previewZoomSpinBox->value());
     s.setValue("profile", profileComboBox->currentText());
     s.setValue("treeIteration", treeCheckBox->isChecked());
+    s.setValue("incremental", incrementalCheckBox->isChecked());
+    s.setValue("threads", threadsSpinBox->value());
     s.endGroup();
     QWidget::closeEvent(event);
 }
@@ -118,9 +138,6 @@ void QWatermark::selectDestinationFolder(void)
 //Execute the watermark
 void QWatermark::doWatermark(void)
 {
-	QImage resultImage;
-	QPainter painter;
-
     Profile profile = Profile::getProfile(profileComboBox->currentText());
     if (!profile.isValid())
     {
@@ -128,184 +145,270 @@ void QWatermark::doWatermark(void)
         return;
     }
 
-    QStringList filesToProcess;
-    QDir::Filters filters = QDir::NoDotAndDotDot | QDir::Readable | QDir::Files | QDir::AllDirs;
-    QDirIterator::IteratorFlags flags = treeCheckBox->isChecked()
-                                            ? QDirIterator::Subdirectories | QDirIterator::FollowSymlinks
-                                            : QDirIterator::NoIteratorFlags;
-    QDirIterator it(sourceLineEdit->text(), filters, flags);
-    while (it.hasNext())
+    BatchJob job;
+    job.sourcePath = sourceLineEdit->text();
+    job.destinationPath = destinationLineEdit->text();
+    job.profile = profileComboBox->currentText();
+    job.position = position();
+    job.recursive = treeCheckBox->isChecked();
+    job.incremental = incrementalCheckBox->isChecked();
+    job.jpegRegion = QSettings().value("Engine/jpegRegion", true).toBool();
+    if (!m_jobs.add(&job))
+        qDebug() << "Cannot store the job in" << JobQueue::defaultDir() << "it cannot be resumed";
+
+    bool finished = runJob(&job);
+    if (m_errCnt)
+        showErrors();
+    else if (finished)
     {
-        it.next();
-        if (!QImageReader::imageFormat(it.filePath()).isNull())
-            filesToProcess << it.filePath();
-        else
-            qDebug() << "Ignored" << it.filePath();
+        QString text = tr("Processing Completed.");
+        if (m_engine->skippedCount())
+            text = tr("Processing Completed. %1 unchanged images skipped.").arg(m_engine->skippedCount());
+
+        // the timing is there for sizing machines, not in the way of the message
+        QMessageBox box(QMessageBox::Information, tr("Success"), text, QMessageBox::Ok, this);
+        box.setDetailedText(m_engine->stats().summary());
+        box.exec();
     }
+    qDebug() << "TODO/FIXME: Clear input/target lineedits?";
+}
+
+bool QWatermark::runJob(BatchJob *job)
+{
+    // a job that cannot be set up must not report the previous one's errors
+    m_errCnt = 0;
 
-    QProgressDialog progress("Applying watermarks...", "Abort", 0, filesToProcess.size(), this);
+    QString errorString;
+    if (!job->apply(m_engine, &errorString))
+    {
+        // it would fail the same way at every start
+        m_jobs.finish(*job);
+        QMessageBox::warning(this, tr("Error"),
+                             tr("%1\nThe job was removed from the queue.").arg(errorString));
+        return false;
+    }
+    m_engine->setThreadCount(threadsSpinBox->value());
+
+    // optional per-stage tuning, e.g. fewer decoders for a slow NAS
+    QSettings s;
+    s.beginGroup("Engine");
+    if (s.contains("decodeThreads"))
+        m_engine->setDecodeThreads(s.value("decodeThreads").toInt());
+    if (s.contains("compositeThreads"))
+        m_engine->setCompositeThreads(s.value("compositeThreads").toInt());
+    if (s.contains("encodeThreads"))
+        m_engine->setEncodeThreads(s.value("encodeThreads").toInt());
+    if (s.contains("maxInFlight"))
+        m_engine->setMaxInFlight(s.value("maxInFlight").toInt());
+    // in MB, 0 picks a share of the physical memory
+    m_engine->setMemoryBudget(s.value("memoryBudget", 0).toLongLong() * 1024 * 1024);
+    m_engine->setLargestFirst(s.value("largestFirst", true).toBool());
+    m_engine->setRetries(s.value("retries", 2).toInt());
+    m_engine->setRetryDelay(s.value("retryDelay", 500).toInt());
+    m_engine->setMaxErrors(s.value("maxErrors", 0).toInt());
+    s.endGroup();
+
+    // an interrupted job goes on where it stopped
+    m_engine->setCompletedFiles(m_jobs.completed(*job));
+    job->state = BatchJob::Running;
+    m_jobs.save(*job);
+    m_jobs.begin(*job);
+
+    QProgressDialog progress("Applying watermarks...", "Abort", 0, 0, this);
     progress.setWindowModality(Qt::WindowModal);
+    // the total grows while the scan runs, done may catch up with it meanwhile
+    progress.setAutoReset(false);
+    progress.setAutoClose(false);
+    connect(m_engine, SIGNAL(discovered(int)), this, SLOT(updateProgress()));
+    connect(m_engine, SIGNAL(progress(int)), this, SLOT(updateProgress()));
+    connect(m_engine, SIGNAL(fileStarted(QString)), this, SLOT(fileStarted(QString)));
+    connect(m_engine, SIGNAL(fileWritten(QString)), this, SLOT(fileWritten(QString)));
+    connect(&progress, SIGNAL(canceled()), m_engine, SLOT(cancel()));
     progress.show();
 
-    int errCnt = 0;
-
-	//Iterate over images
-    for(int i = 0; i < filesToProcess.size(); ++i){
-
-        qDebug() << "FILE" << filesToProcess.at(i);
-
-        if (progress.wasCanceled())
-        {
-            qDebug() << "TODO/FIXME: cleanup already created files";
-            break;
-        }
-        progress.setValue(i+1);
-        progress.setLabelText(filesToProcess.at(i));
-
-		//Load image
-        if (!resultImage.load(filesToProcess.at(i)))
-        {
-            qDebug() << "Cannot load" << filesToProcess.at(i) << "skipping";
-            continue;
-        }
-        if (!painter.begin(&resultImage))
-        {
-            qDebug() << "TODO/FIXME: painter.begin check" << filesToProcess.at(i);
-            continue;
-        }
-
-        //painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-        paintOne(resultImage.width(), resultImage.height(), &painter, &profile);
-        painter.end();
-
-        //save the image
-        QString tgtPath = getTargetPath(filesToProcess.at(i));
-        qDebug() << "SAVE" << tgtPath;
-        QDir dir = QFileInfo(tgtPath).absoluteDir();
-        if (!dir.exists(dir.path()))
-            dir.mkpath(dir.path());
-
-        if(!resultImage.save(tgtPath, 0, 100))
-        {
-            errCnt++;
-            if (QMessageBox::question(this, tr("Error"),
-                                  tr("An error occurred while saving the image '%1'. Continue?").arg(tgtPath),
-                                  QMessageBox::Yes, QMessageBox::No)
-                    == QMessageBox::No)
-            {
-                qDebug() << "User canceled processing after an error";
-                break;
-            }
-        }
-
-	}
-
-    if (errCnt == 0)
-        QMessageBox::information(this, tr("Success"), tr("Processing Completed."));
-    qDebug() << "TODO/FIXME: Clear input/target lineedits?";
+    m_progress = &progress;
+
+    // workers report through queued signals; keep the GUI alive until they finish
+    QEventLoop loop;
+    connect(m_engine, SIGNAL(finished()), &loop, SLOT(quit()));
+    m_engine->start();
+    if (m_engine->isRunning())
+        loop.exec();
+
+    disconnect(m_engine, SIGNAL(discovered(int)), this, SLOT(updateProgress()));
+    disconnect(m_engine, SIGNAL(progress(int)), this, SLOT(updateProgress()));
+    disconnect(m_engine, SIGNAL(fileStarted(QString)), this, SLOT(fileStarted(QString)));
+    disconnect(m_engine, SIGNAL(fileWritten(QString)), this, SLOT(fileWritten(QString)));
+    m_progress = 0;
+    progress.close();
+
+    m_jobs.end();
+    if (m_engine->wasCanceled())
+    {
+        job->state = BatchJob::Interrupted;
+        m_jobs.save(*job);
+        return false;
+    }
+
+    m_jobs.finish(*job);
+    return true;
 }
 
-void QWatermark::paintOne(int w, int h, QPainter *painter, Profile *profile)
+void QWatermark::resumeJobs()
 {
-    int imageX = 0;
-    int imageY = 0;
+    QList<BatchJob> jobs = m_jobs.jobs();
+    if (jobs.isEmpty())
+        return;
 
-    painter->setOpacity(profile->transparency());
+    QStringList names;
+    foreach (const BatchJob &job, jobs)
+        names << job.name + " (" + job.sourcePath + ")";
 
-    QSize size = profile->size(w, h);
+    QMessageBox box(QMessageBox::Question, tr("Unfinished Jobs"),
+                    tr("%1 batch jobs did not finish. Resume them now?").arg(jobs.size()),
+                    QMessageBox::Yes | QMessageBox::No | QMessageBox::Discard, this);
+    box.setDetailedText(names.join("\n"));
+    int ret = box.exec();
 
-    //controls which logo position is selected
-    if (ULRadioButton->isChecked())
-    {
-        //Do nothing, is default already set
-    }
-    else if (UCRadioButton->isChecked())
-    {
-        imageX = w/2 - size.width()/2;
-        imageY = 0 + profile->marginVertical();
-    }
-    else if (URRadioButton->isChecked())
-    {
-        imageX = w - size.width() - profile->marginHorizontal();
-        imageY = 0 + profile->marginVertical();
-    }
-    else if (CLRadioButton->isChecked())
-    {
-        imageX = 0 + profile->marginHorizontal();
-        imageY = h/2 - size.height()/2;
-    }
-    else if (CCRadioButton->isChecked())
-    {
-        imageX = w/2 - size.width()/2;
-        imageY = h/2 - size.height()/2;
-    }
-    else if (CRRadioButton->isChecked())
-    {
-        imageX = w - size.width() - profile->marginHorizontal();
-        imageY = h/2 - size.height()/2;
-    }
-    else if (LLRadioButton->isChecked())
-    {
-        imageX = 0 + profile->marginHorizontal();
-        imageY = h - size.height() - profile->marginVertical();
-    }
-    else if (LCRadioButton->isChecked())
+    if (ret == QMessageBox::Discard)
     {
-        imageX = w/2 - size.width()/2;
-        imageY = h - size.height() - profile->marginVertical();
+        foreach (const BatchJob &job, jobs)
+            m_jobs.finish(job);
+        return;
     }
-    else if (LRRadioButton->isChecked())
+    if (ret != QMessageBox::Yes)
+        return;
+
+    // back to back, a cancel keeps the rest for later
+    int errors = 0;
+    for (int i = 0; i < jobs.size(); ++i)
     {
-        imageX = w - size.width() - profile->marginHorizontal();
-        imageY = h - size.height() - profile->marginVertical();
+        bool finished = runJob(&jobs[i]);
+        if (m_errCnt)
+            showErrors();
+        errors += m_errCnt;
+        // a job that could not be set up is gone, go on with the next
+        if (!finished && m_engine->wasCanceled())
+            return;
+        if (!finished)
+            ++errors;
     }
 
-    switch (profile->type())
-    {
-    case Profile::Image:
-        painter->drawImage(imageX, imageY, profile->logo(), 0, 0, -1, -1);
-        break;
-    case Profile::Text:
-    {
-        painter->setBrush(profile->mainColor());
-        QPen pen(profile->outlineColor());
-        pen.setWidth(profile->outlineSize());
-        painter->setPen(pen);
+    if (errors == 0)
+        QMessageBox::information(this, tr("Success"), tr("Processing Completed."));
+}
 
-        QPainterPath path;
-        path.addText(imageX, imageY+size.height(), profile->font(), profile->text());
-        painter->drawPath(path);
+void QWatermark::showErrors()
+{
+    QString text = tr("%1 images could not be processed.").arg(m_errCnt);
+    if (m_engine->tooManyErrors())
+        text += ' ' + tr("Processing was stopped after too many errors.");
+
+    QStringList errors = m_engine->stats().errors();
+    QMessageBox box(QMessageBox::Warning, tr("Error"), text, QMessageBox::Ok, this);
+    box.setDetailedText(errors.join("\n") + "\n\n" + m_engine->stats().summary());
+    box.exec();
+}
 
-        break;
-    }
-    }
+void QWatermark::fileWritten(const QString &fname)
+{
+    m_jobs.markCompleted(fname);
+}
+
+void QWatermark::fileStarted(const QString &fname)
+{
+    m_currentFile = fname;
+}
 
+void QWatermark::updateProgress()
+{
+    if (!m_progress)
+        return;
+
+    int discovered = m_engine->discoveredCount();
+    int done = m_engine->doneCount();
+
+    // weighted by pixels, a large image moves the bar more than a thumbnail
+    m_progress->setMaximum(discovered ? 1000 : 0);
+    m_progress->setValue(m_engine->progressPermille());
+    QString text = tr("Processed %1 of %2 files found so far\n%3")
+                   .arg(done).arg(discovered).arg(m_currentFile);
+    int left = m_engine->secondsLeft();
+    if (left >= 0)
+        text += '\n' + tr("About %1:%2 left").arg(left / 60).arg(left % 60, 2, 10, QChar('0'));
+    // reported together at the end, the batch goes on meanwhile
+    if (m_errCnt)
+        text += '\n' + tr("%1 images failed").arg(m_errCnt);
+    m_progress->setLabelText(text);
+}
+
+void QWatermark::watermarkError(const QString &fname, const QString &message)
+{
+    Q_UNUSED(fname);
+
+    qDebug() << "Error:" << message;
+    m_errCnt++;
+    updateProgress();
+}
+
+WatermarkEngine::Position QWatermark::position() const
+{
+    QAbstractButton *b = buttonGroup->checkedButton();
+
+    if (b == UCRadioButton)
+        return WatermarkEngine::UpperCenter;
+    else if (b == URRadioButton)
+        return WatermarkEngine::UpperRight;
+    else if (b == CLRadioButton)
+        return WatermarkEngine::CenterLeft;
+    else if (b == CCRadioButton)
+        return WatermarkEngine::Center;
+    else if (b == CRRadioButton)
+        return WatermarkEngine::CenterRight;
+    else if (b == LLRadioButton)
+        return WatermarkEngine::LowerLeft;
+    else if (b == LCRadioButton)
+        return WatermarkEngine::LowerCenter;
+    else if (b == LRRadioButton)
+        return WatermarkEngine::LowerRight;
+
+    return WatermarkEngine::UpperLeft;
+}
+
+void QWatermark::profileChanged()
+{
+    m_previewProfile = Profile::getProfile(profileComboBox->currentText());
+    preview();
+}
+
+void QWatermark::profilesChanged()
+{
+    QString current = profileComboBox->currentText();
+
+    profileComboBox->blockSignals(true);
+    profileComboBox->clear();
+    profileComboBox->addItems(Profile::getProfiles());
+    int ix = profileComboBox->findText(current);
+    profileComboBox->setCurrentIndex(ix > -1 ? ix : 0);
+    profileComboBox->blockSignals(false);
+
+    profileChanged();
 }
 
 void QWatermark::preview()
 {
-    Profile profile = Profile::getProfile(profileComboBox->currentText());
-    if (!profile.isValid())
+    if (!m_previewProfile.isValid())
     {
         qDebug() << "TODO/FIXME: invalid profile msg?";
         return;
     }
 
-    QImage img(":/preview.jpg");
-    QPainter p(&img);
-    paintOne(img.width(), img.height(), &p, &profile);
-    p.end();
-
-    int zoom = previewZoomSpinBox->value();
-    previewLabel->setPixmap(QPixmap::fromImage(img).scaledToHeight(img.height()/100.0*zoom));
+    m_previewRenderer->render(m_previewPath, previewZoomSpinBox->value(), m_previewProfile, position());
 }
 
-QString QWatermark::getTargetPath(const QString &fname)
+void QWatermark::previewRendered(const QImage &image)
 {
-    QRegExp re("^" + sourceLineEdit->text());
-    QString ret = fname;
-    ret.replace(re, destinationLineEdit->text());
-    return ret;
+    previewLabel->setPixmap(QPixmap::fromImage(image));
 }
 
 void QWatermark::about(void)
@@ -339,7 +442,7 @@ void QWatermark::editProfileButton_clicked()
 {
     ProfileDialog pd(profileComboBox->currentText());
     pd.exec();
-    preview();
+    profileChanged();
 }
 
 
@@ -5,9 +5,13 @@
 #include <QFileSystemModel>
 
 #include "ui_qwatermark.h"
+#include "watermarkengine.h"
+#include "profile.h"
+#include "jobqueue.h"
 
 
-class Profile;
+class QProgressDialog;
+class PreviewRenderer;
 
 class QWatermark : public QMainWindow, public Ui::MainWindow
 {
@@ -17,13 +21,27 @@ public:
     QWatermark(QWidget *parent = 0);
 
 private:
-    bool checkDir(const QString& name);
-    QString getTargetPath(const QString &fname);
+    WatermarkEngine *m_engine;
+    QProgressDialog *m_progress;
+    QString m_currentFile;
+    int m_errCnt;
+
+    PreviewRenderer *m_previewRenderer;
+    QString m_previewPath;
+    Profile m_previewProfile;
 
-    void paintOne(int w, int h, QPainter *painter, Profile *profile);
+    JobQueue m_jobs;
+
+    bool checkDir(const QString& name);
+    WatermarkEngine::Position position() const;
 
     void closeEvent(QCloseEvent *event);
 
+    // false if canceled, the job then stays queued
+    bool runJob(BatchJob *job);
+    // the failures of the last run, with the engine's messages as details
+    void showErrors();
+
 private slots:
     void checkConditions();
 
@@ -32,7 +50,16 @@ private slots:
     void editProfileButton_clicked();
 
     void doWatermark(void);
+    void resumeJobs();
+    void fileStarted(const QString &fname);
+    void fileWritten(const QString &fname);
+    void updateProgress();
+    void watermarkError(const QString &fname, const QString &message);
+    void profileChanged();
+    // the list or a profile changed, e.g. in another instance
+    void profilesChanged();
     void preview();
+    void previewRendered(const QImage &image);
 
     void about(void);
 
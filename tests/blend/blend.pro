@@ -0,0 +1,6 @@
+TEMPLATE = app
+TARGET = tst_blend
+
+include(../tests.pri)
+
+SOURCES   += tst_blend.cpp
@@ -0,0 +1,153 @@
+#include <QtTest>
+#include <QImage>
+#include <QPainter>
+
+#include "blend.h"
+#include "testsupport.h"
+
+
+Q_DECLARE_METATYPE(QImage::Format)
+
+/*! blendSprite() against QPainter::drawImage() with setOpacity(), for
+ * every row kernel the CPU runs, the scalar one included.
+ */
+class tst_Blend : public QObject
+{
+    Q_OBJECT
+
+private:
+    QString m_kernel;
+
+    static QImage sprite();
+    static QImage background(QImage::Format format);
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void matchesQPainter_data();
+    void matchesQPainter();
+    void unsupportedFormat();
+};
+
+// premultiplied, with transparent, opaque and translucent pixels mixed;
+// the odd width leaves tails for the vector kernels
+QImage tst_Blend::sprite()
+{
+    QImage img(37, 9, QImage::Format_ARGB32_Premultiplied);
+    TestRandom random(1);
+    for (int y = 0; y < img.height(); ++y)
+    {
+        QRgb *line = reinterpret_cast<QRgb *>(img.scanLine(y));
+        for (int x = 0; x < img.width(); ++x)
+        {
+            int a;
+            switch (random.bounded(4))
+            {
+            case 0:
+                a = 0;
+                break;
+            case 1:
+                a = 255;
+                break;
+            default:
+                a = random.bounded(256);
+                break;
+            }
+            line[x] = qRgba(random.bounded(a + 1), random.bounded(a + 1), random.bounded(a + 1), a);
+        }
+    }
+    return img;
+}
+
+QImage tst_Blend::background(QImage::Format format)
+{
+    QImage img(40, 12, QImage::Format_ARGB32_Premultiplied);
+    TestRandom random(2);
+    for (int y = 0; y < img.height(); ++y)
+    {
+        QRgb *line = reinterpret_cast<QRgb *>(img.scanLine(y));
+        for (int x = 0; x < img.width(); ++x)
+        {
+            int a = format == QImage::Format_ARGB32_Premultiplied ? random.bounded(256) : 255;
+            line[x] = qRgba(random.bounded(a + 1), random.bounded(a + 1), random.bounded(a + 1), a);
+        }
+    }
+    return img.convertToFormat(format);
+}
+
+void tst_Blend::initTestCase()
+{
+    m_kernel = blendKernelName();
+    QVERIFY(blendKernels().contains("scalar"));
+    QVERIFY(!setBlendKernel("no-such-kernel"));
+}
+
+void tst_Blend::cleanupTestCase()
+{
+    setBlendKernel(m_kernel);
+}
+
+void tst_Blend::matchesQPainter_data()
+{
+    QTest::addColumn<QString>("kernel");
+    QTest::addColumn<QImage::Format>("format");
+    QTest::addColumn<qreal>("opacity");
+    QTest::addColumn<QPoint>("pos");
+
+    QList<QImage::Format> formats;
+    formats << QImage::Format_RGB32 << QImage::Format_ARGB32_Premultiplied << QImage::Format_RGB888;
+    QList<qreal> opacities;
+    // constant alphas 0, 1, 128 and 255, and one that does not hit a whole alpha
+    opacities << 0 << 1 / 255.0 << 128 / 255.0 << 1 << 0.37;
+
+    foreach (const QString &kernel, blendKernels())
+    {
+        foreach (QImage::Format format, formats)
+        {
+            foreach (qreal opacity, opacities)
+            {
+                QByteArray tag = kernel.toLatin1() + ' ' + QByteArray::number(format) + ' '
+                                 + QByteArray::number(opacity);
+                QTest::newRow((tag + " inside").constData()) << kernel << format << opacity << QPoint(2, 1);
+                QTest::newRow((tag + " clipped").constData()) << kernel << format << opacity << QPoint(-3, 6);
+            }
+        }
+    }
+}
+
+void tst_Blend::matchesQPainter()
+{
+    QFETCH(QString, kernel);
+    QFETCH(QImage::Format, format);
+    QFETCH(qreal, opacity);
+    QFETCH(QPoint, pos);
+
+    QVERIFY(setBlendKernel(kernel));
+
+    QImage src = sprite();
+    QImage expected = background(format);
+    QImage actual = expected.copy();
+
+    QPainter p(&expected);
+    p.setOpacity(opacity);
+    p.drawImage(pos, src);
+    p.end();
+
+    QVERIFY(blendSprite(&actual, pos.x(), pos.y(), src, opacity));
+    QString diff = firstDifference(actual, expected, "QPainter");
+    QVERIFY2(diff.isEmpty(), qPrintable(diff));
+}
+
+void tst_Blend::unsupportedFormat()
+{
+    QImage dst = background(QImage::Format_RGB32).convertToFormat(QImage::Format_RGB16);
+    QImage before = dst.copy();
+
+    QVERIFY(!blendSprite(&dst, 0, 0, sprite(), 0.5));
+    QVERIFY(dst == before);
+    QVERIFY(!blendSprite(&dst, 0, 0, sprite().convertToFormat(QImage::Format_ARGB32), 0.5));
+}
+
+QWATERMARK_TEST_MAIN(tst_Blend)
+#include "tst_blend.moc"
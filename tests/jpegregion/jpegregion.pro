@@ -0,0 +1,6 @@
+TEMPLATE = app
+TARGET = tst_jpegregion
+
+include(../tests.pri)
+
+SOURCES   += tst_jpegregion.cpp
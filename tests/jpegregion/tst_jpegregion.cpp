@@ -0,0 +1,133 @@
+#include <QtTest>
+#include <QBuffer>
+#include <QImage>
+#include <QImageWriter>
+
+#include "jpegregion.h"
+#include "profile.h"
+#include "renderplan.h"
+#include "watermarkengine.h"
+#include "testsupport.h"
+
+
+// Qt's JPEG writer subsamples chroma 2x2, i.e. 16x16 MCUs
+static const int s_mcu = 16;
+
+/*! JpegRegionEditor leaves the image alone outside the MCUs under the
+ * watermark.
+ */
+class tst_JpegRegion : public QObject
+{
+    Q_OBJECT
+
+private:
+    QByteArray m_jpeg;
+    Profile m_profile;
+
+private slots:
+    void initTestCase();
+
+    void unchangedOutsideWatermark_data();
+    void unchangedOutsideWatermark();
+    void untouchedIsOriginal();
+};
+
+void tst_JpegRegion::initTestCase()
+{
+    if (!JpegRegionEditor::isAvailable())
+        QSKIP("built without libjpeg", SkipAll);
+
+    // detail everywhere, so any re-encoded block would show
+    QImage img(200, 120, QImage::Format_RGB32);
+    for (int y = 0; y < img.height(); ++y)
+    {
+        for (int x = 0; x < img.width(); ++x)
+            img.setPixel(x, y, qRgb(x * 255 / img.width(), (x ^ y) & 0xff, (x * y) & 0xff));
+    }
+
+    QBuffer buffer(&m_jpeg);
+    buffer.open(QIODevice::WriteOnly);
+    QImageWriter writer(&buffer, "jpeg");
+    writer.setQuality(85);
+    QVERIFY2(writer.write(img), qPrintable(writer.errorString()));
+
+    m_profile = Profile("tst_jpegregion");
+    m_profile.setType(Profile::Text);
+    m_profile.setText("QW");
+    QFont font;
+    font.setPixelSize(20);
+    m_profile.setFont(font);
+    m_profile.setMainColor(Qt::white);
+    m_profile.setOutlineColor(Qt::black);
+    m_profile.setOutlineSize(1);
+    m_profile.setTransparency(0.7);
+    m_profile.setMarginHorizontal(10);
+    m_profile.setMarginVertical(10);
+}
+
+void tst_JpegRegion::unchangedOutsideWatermark_data()
+{
+    QTest::addColumn<int>("position");
+
+    for (int p = WatermarkEngine::UpperLeft; p <= WatermarkEngine::LowerRight; ++p)
+    {
+        QTest::newRow(WatermarkEngine::positionName(WatermarkEngine::Position(p)).toLatin1().constData())
+                << p;
+    }
+}
+
+void tst_JpegRegion::unchangedOutsideWatermark()
+{
+    QFETCH(int, position);
+
+    JpegRegionEditor editor;
+    QVERIFY2(editor.open(m_jpeg), qPrintable(editor.errorString()));
+    const QSize size = editor.size();
+
+    RenderPlan plan(m_profile, WatermarkEngine::Position(position));
+    QVERIFY(plan.paint(&editor));
+    QByteArray out;
+    QVERIFY2(editor.write(&out), qPrintable(editor.errorString()));
+
+    QImage original = QImage::fromData(m_jpeg, "jpeg");
+    QImage edited = QImage::fromData(out, "jpeg");
+    QVERIFY(!original.isNull());
+    QCOMPARE(edited.size(), original.size());
+
+    QRect changed = WatermarkEngine::watermarkRect(size.width(), size.height(), &m_profile,
+                                                   WatermarkEngine::Position(position));
+    QVERIFY(!changed.isEmpty());
+    QVERIFY(edited != original);
+
+    /* Whole MCUs are re-encoded. Upsampling the chroma reads one sample
+     * into the neighbouring MCU, so one more MCU around them may decode
+     * differently too; everything beyond must not.
+     */
+    QRect mcus(QPoint(changed.left() / s_mcu * s_mcu, changed.top() / s_mcu * s_mcu),
+               QPoint((changed.right() / s_mcu + 1) * s_mcu - 1, (changed.bottom() / s_mcu + 1) * s_mcu - 1));
+    QRect skip = mcus.adjusted(-s_mcu, -s_mcu, s_mcu, s_mcu);
+
+    QString diff = firstDifference(edited, original, "original", skip);
+    QVERIFY2(diff.isEmpty(), qPrintable(diff));
+}
+
+void tst_JpegRegion::untouchedIsOriginal()
+{
+    JpegRegionEditor editor;
+    QVERIFY(editor.open(m_jpeg));
+
+    QImage sprite(8, 8, QImage::Format_ARGB32_Premultiplied);
+    sprite.fill(0xff000000);
+    // entirely outside the frame
+    QVERIFY(editor.apply(sprite, QPoint(-100, -100), 1.0));
+
+    QByteArray out;
+    out.reserve(1 << 20);
+    QVERIFY(editor.write(&out));
+    QVERIFY(out == m_jpeg);
+    // written into the caller's buffer, not swapped for another one
+    QVERIFY(out.capacity() >= 1 << 20);
+}
+
+QWATERMARK_TEST_MAIN(tst_JpegRegion)
+#include "tst_jpegregion.moc"
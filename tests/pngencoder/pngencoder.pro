@@ -0,0 +1,6 @@
+TEMPLATE = app
+TARGET = tst_pngencoder
+
+include(../tests.pri)
+
+SOURCES   += tst_pngencoder.cpp
@@ -0,0 +1,324 @@
+#include <QtTest>
+#include <QBuffer>
+#include <QDir>
+#include <QImage>
+#include <QImageReader>
+#include <QScopedPointer>
+#include <QTemporaryFile>
+#if QT_VERSION >= 0x050E00
+#include <QColorSpace>
+#endif
+
+#include "pngencoder.h"
+#include "rowstream.h"
+#include "testsupport.h"
+
+
+/*! PngEncoder output decoded again by Qt's PNG reader: same pixels,
+ * same colour type, whatever the chunking and the zlib level. Also the
+ * PNG RowReader of the streaming path, on good and crafted headers.
+ */
+class tst_PngEncoder : public QObject
+{
+    Q_OBJECT
+
+private:
+    enum Kind {
+        Rgb,
+        Rgba,
+        Gray,
+        Palette,
+        Mono
+    };
+
+    static QImage image(Kind kind, const QSize &size);
+    static QImage decode(const QByteArray &png);
+    static int colorType(const QByteArray &png);
+    static QByteArray encode(const QImage &image);
+
+private slots:
+    void initTestCase();
+
+    void roundTrip_data();
+    void roundTrip();
+    void rows_data();
+    void rows();
+    void iccProfile();
+    void rowReader();
+    void rowReaderBadSize_data();
+    void rowReaderBadSize();
+};
+
+// smooth gradients for the filters and noise for the Huffman coder
+QImage tst_PngEncoder::image(Kind kind, const QSize &size)
+{
+    QImage img(size, QImage::Format_ARGB32);
+    TestRandom random(size.width() * 31 + size.height());
+    for (int y = 0; y < img.height(); ++y)
+    {
+        QRgb *line = reinterpret_cast<QRgb *>(img.scanLine(y));
+        for (int x = 0; x < img.width(); ++x)
+        {
+            int noise = random.bounded(16);
+            line[x] = qRgba((x + noise) & 0xff, (y * 3) & 0xff, (x ^ y) & 0xff,
+                            kind == Rgba ? (x + y) & 0xff : 255);
+        }
+    }
+
+    switch (kind)
+    {
+    case Rgb:
+        return img.convertToFormat(QImage::Format_RGB32);
+    case Rgba:
+        return img;
+    case Gray:
+#if QT_VERSION >= 0x050500
+        return img.convertToFormat(QImage::Format_Grayscale8);
+#else
+        break;
+#endif
+    case Palette:
+    {
+        QVector<QRgb> table;
+        for (int i = 0; i < 16; ++i)
+            table << qRgba(i * 16, 255 - i * 16, i * 5, i < 4 ? i * 60 : 255);
+        QImage indexed(size, QImage::Format_Indexed8);
+        indexed.setColorTable(table);
+        for (int y = 0; y < size.height(); ++y)
+        {
+            for (int x = 0; x < size.width(); ++x)
+                indexed.setPixel(x, y, ((x / 3) ^ y ^ random.bounded(2)) & 15);
+        }
+        return indexed;
+    }
+    case Mono:
+        return img.convertToFormat(QImage::Format_Mono, Qt::ThresholdDither);
+    }
+
+    return QImage();
+}
+
+QImage tst_PngEncoder::decode(const QByteArray &png)
+{
+    QBuffer buffer;
+    buffer.setData(png);
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader reader(&buffer, "png");
+    return reader.read();
+}
+
+// straight from IHDR
+int tst_PngEncoder::colorType(const QByteArray &png)
+{
+    return png.size() > 25 ? uchar(png.at(25)) : -1;
+}
+
+QByteArray tst_PngEncoder::encode(const QImage &image)
+{
+    QByteArray png;
+    QBuffer buffer(&png);
+    buffer.open(QIODevice::WriteOnly);
+    PngEncoder encoder;
+    if (!encoder.write(image, &buffer))
+        return QByteArray();
+    return png;
+}
+
+void tst_PngEncoder::initTestCase()
+{
+    if (!PngEncoder::isAvailable())
+        QSKIP("built without zlib", SkipAll);
+}
+
+void tst_PngEncoder::roundTrip_data()
+{
+    QTest::addColumn<QImage>("source");
+    QTest::addColumn<int>("level");
+    QTest::addColumn<int>("threads");
+    QTest::addColumn<int>("colorType");
+
+    QList<Kind> kinds;
+    kinds << Rgb << Rgba << Palette << Mono;
+#if QT_VERSION >= 0x050500
+    kinds << Gray;
+#endif
+    const char *kindNames[] = { "rgb", "rgba", "gray", "palette", "mono" };
+    const int colorTypes[] = { 2, 6, 0, 3, 3 };
+
+    // one chunk, a few and as many as the threads allow; the chunks are 256 KB of rows
+    QList<QSize> sizes;
+    sizes << QSize(7, 3) << QSize(700, 500) << QSize(1200, 800);
+    QList<int> threads;
+    threads << 1 << 3 << 8;
+    QList<int> levels;
+    levels << 0 << 1 << 9;
+
+    foreach (Kind kind, kinds)
+    {
+        foreach (const QSize &size, sizes)
+        {
+            QImage source = image(kind, size);
+            foreach (int t, threads)
+            {
+                foreach (int level, levels)
+                {
+                    QString tag = QString("%1 %2x%3 threads %4 level %5").arg(kindNames[kind])
+                                  .arg(size.width()).arg(size.height()).arg(t).arg(level);
+                    QTest::newRow(tag.toLatin1().constData()) << source << level << t << colorTypes[kind];
+                }
+            }
+        }
+    }
+}
+
+void tst_PngEncoder::roundTrip()
+{
+    QFETCH(QImage, source);
+    QFETCH(int, level);
+    QFETCH(int, threads);
+    QFETCH(int, colorType);
+
+    QByteArray png;
+    QBuffer buffer(&png);
+    buffer.open(QIODevice::WriteOnly);
+
+    PngEncoder encoder;
+    encoder.setCompression(level);
+    encoder.setMaxThreads(threads);
+    QVERIFY2(encoder.write(source, &buffer), qPrintable(encoder.errorString()));
+
+    QCOMPARE(tst_PngEncoder::colorType(png), colorType);
+
+    QImage decoded = decode(png);
+    QVERIFY(!decoded.isNull());
+    QString diff = firstDifference(decoded.convertToFormat(QImage::Format_ARGB32),
+                                   source.convertToFormat(QImage::Format_ARGB32), "source");
+    QVERIFY2(diff.isEmpty(), qPrintable(diff));
+}
+
+void tst_PngEncoder::rows_data()
+{
+    QTest::addColumn<bool>("alpha");
+    QTest::addColumn<int>("level");
+
+    QTest::newRow("rgb level 0") << false << 0;
+    QTest::newRow("rgb level 9") << false << 9;
+    QTest::newRow("rgba level 1") << true << 1;
+}
+
+void tst_PngEncoder::rows()
+{
+    QFETCH(bool, alpha);
+    QFETCH(int, level);
+
+    QImage source = image(alpha ? Rgba : Rgb, QSize(300, 250));
+
+    QByteArray png;
+    QBuffer buffer(&png);
+    buffer.open(QIODevice::WriteOnly);
+
+    PngEncoder encoder;
+    encoder.setCompression(level);
+    QVERIFY(encoder.begin(source.size(), alpha, &buffer));
+    // uneven bands, as the streaming path hands them over
+    for (int y = 0; y < source.height(); y += 64)
+        QVERIFY(encoder.writeRows(source.copy(0, y, source.width(), qMin(64, source.height() - y))));
+    QVERIFY2(encoder.finish(), qPrintable(encoder.errorString()));
+
+    QImage decoded = decode(png);
+    QVERIFY(!decoded.isNull());
+    QString diff = firstDifference(decoded.convertToFormat(QImage::Format_ARGB32),
+                                   source.convertToFormat(QImage::Format_ARGB32), "source");
+    QVERIFY2(diff.isEmpty(), qPrintable(diff));
+}
+
+void tst_PngEncoder::iccProfile()
+{
+#if QT_VERSION >= 0x050E00
+    QImage source = image(Rgb, QSize(40, 30));
+    source.setColorSpace(QColorSpace(QColorSpace::DisplayP3));
+
+    QByteArray png;
+    QBuffer buffer(&png);
+    buffer.open(QIODevice::WriteOnly);
+    PngEncoder encoder;
+    QVERIFY(encoder.write(source, &buffer));
+
+    QVERIFY(png.contains("iCCP"));
+    QImage decoded = decode(png);
+    QVERIFY(decoded.colorSpace().isValid());
+    QVERIFY(decoded.colorSpace() == source.colorSpace());
+#else
+    QSKIP("QColorSpace needs Qt 5.14", SkipAll);
+#endif
+}
+
+// the streaming reader of the large image path reads what the encoder wrote
+void tst_PngEncoder::rowReader()
+{
+    QImage source = image(Rgba, QSize(300, 150));
+
+    QTemporaryFile file(QDir::tempPath() + "/tst_pngencoder-XXXXXX.png");
+    QVERIFY(file.open());
+    file.write(encode(source));
+    file.close();
+
+    QScopedPointer<RowReader> reader(RowReader::create(file.fileName()));
+    QVERIFY(reader);
+    QVERIFY2(reader->open(), qPrintable(reader->errorString()));
+    QCOMPARE(reader->size(), source.size());
+    QVERIFY(reader->hasAlpha());
+
+    QImage band(source.width(), 64, QImage::Format_ARGB32);
+    for (int y = 0; y < source.height(); y += band.height())
+    {
+        if (source.height() - y < band.height())
+            band = QImage(source.width(), source.height() - y, QImage::Format_ARGB32);
+        QVERIFY2(reader->read(&band), qPrintable(reader->errorString()));
+        QString diff = firstDifference(band, source.copy(0, y, source.width(), band.height()), "source");
+        QVERIFY2(diff.isEmpty(), qPrintable(QString("band at %1: %2").arg(y).arg(diff)));
+    }
+}
+
+void tst_PngEncoder::rowReaderBadSize_data()
+{
+    QTest::addColumn<uint>("width");
+    QTest::addColumn<uint>("height");
+
+    QTest::newRow("zero width") << 0u << 10u;
+    QTest::newRow("zero height") << 10u << 0u;
+    // RGBA rows of 4 GB, a few bytes once computed in int
+    QTest::newRow("width 2^30") << 0x40000000u << 10u;
+    QTest::newRow("width 2^31") << 0x80000000u << 10u;
+    QTest::newRow("width 2^32 - 1") << 0xffffffffu << 10u;
+    QTest::newRow("height 2^31") << 10u << 0x80000000u;
+}
+
+// a crafted IHDR must fail open(), not size the row buffers from it
+void tst_PngEncoder::rowReaderBadSize()
+{
+    QFETCH(uint, width);
+    QFETCH(uint, height);
+
+    QByteArray png = encode(image(Rgba, QSize(10, 10)));
+    QVERIFY(png.size() > 24);
+    // IHDR's width and height follow the signature and the chunk header
+    for (int i = 0; i < 4; ++i)
+    {
+        png[16 + i] = char(width >> (24 - 8 * i));
+        png[20 + i] = char(height >> (24 - 8 * i));
+    }
+
+    QTemporaryFile file(QDir::tempPath() + "/tst_pngencoder-XXXXXX.png");
+    QVERIFY(file.open());
+    file.write(png);
+    file.close();
+
+    QScopedPointer<RowReader> reader(RowReader::create(file.fileName()));
+    QVERIFY(reader);
+    QVERIFY(!reader->open());
+    QVERIFY(!reader->errorString().isEmpty());
+}
+
+QWATERMARK_TEST_MAIN(tst_PngEncoder)
+#include "tst_pngencoder.moc"
@@ -0,0 +1,11 @@
+# Common setup of the unit tests, included by each test's project file.
+
+QT        += core gui testlib
+CONFIG    += console testcase
+CONFIG    -= app_bundle
+
+INCLUDEPATH += $$PWD
+HEADERS   += $$PWD/testsupport.h
+
+ENGINE_BUILD_DIR = $$OUT_PWD/../../src/engine
+include($$PWD/../src/engine/engine.pri)
@@ -0,0 +1,6 @@
+TEMPLATE = subdirs
+
+# "make check" builds and runs them all
+SUBDIRS = blend \
+    jpegregion \
+    pngencoder
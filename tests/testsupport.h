@@ -0,0 +1,67 @@
+#ifndef TESTSUPPORT_H
+#define TESTSUPPORT_H
+
+#include <QtTest>
+#include <QImage>
+#include <QRect>
+#include <QString>
+
+#include "headless.h"
+
+
+/*! Noise for the test images: the same numbers on every platform and
+ * Qt version, the cheap LCG bench/corpus.cpp uses too.
+ */
+class TestRandom
+{
+public:
+    explicit TestRandom(quint32 seed) : m_state(seed * 2654435761u + 1) {}
+
+    // 0 .. n - 1
+    int bounded(int n)
+    {
+        m_state = m_state * 1664525u + 1013904223u;
+        // the low bits of an LCG repeat quickly
+        return int((m_state >> 8) % quint32(n));
+    }
+
+private:
+    quint32 m_state;
+};
+
+/* The first pixel outside skip that differs, empty when there is none.
+ * expectedName says where the expected image came from.
+ */
+inline QString firstDifference(const QImage &actual, const QImage &expected,
+                               const QString &expectedName, const QRect &skip = QRect())
+{
+    if (actual.size() != expected.size() || actual.format() != expected.format())
+        return "size or format differ";
+
+    for (int y = 0; y < actual.height(); ++y)
+    {
+        for (int x = 0; x < actual.width(); ++x)
+        {
+            if (!skip.contains(x, y) && actual.pixel(x, y) != expected.pixel(x, y))
+            {
+                return QString("pixel %1,%2: %3, %4 %5")
+                        .arg(x).arg(y)
+                        .arg(actual.pixel(x, y), 8, 16, QChar('0'))
+                        .arg(expectedName)
+                        .arg(expected.pixel(x, y), 8, 16, QChar('0'));
+            }
+        }
+    }
+    return QString();
+}
+
+// QTEST_MAIN(), but headless like the command line tool
+#define QWATERMARK_TEST_MAIN(TestObject) \
+int main(int argc, char *argv[]) \
+{ \
+    HeadlessApplication app(argc, argv); \
+    TestObject tc; \
+    return QTest::qExec(&tc, argc, argv); \
+}
+
+#endif // TESTSUPPORT_H